@@ -925,6 +925,8 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
 /******************************** 
  * Client/server helper functions
  ********************************/
+static int open_listenfd_opt(char *port, int reuseport);
+
 /*
  * open_clientfd - Open connection to server at <hostname, port> and
  *     return a socket descriptor ready for reading and writing. This
@@ -974,6 +976,21 @@ int open_clientfd(char *hostname, char *port) {
  */
 /* $begin open_listenfd */
 int open_listenfd(char *port) 
+{
+    return open_listenfd_opt(port, 0);
+}
+
+/*
+ * open_reuseport_listenfd - Like open_listenfd, but with SO_REUSEPORT set
+ *     so several sockets can listen on the same port. The kernel then
+ *     load-balances incoming connections across them.
+ */
+int open_reuseport_listenfd(char *port) 
+{
+    return open_listenfd_opt(port, 1);
+}
+
+static int open_listenfd_opt(char *port, int reuseport) 
 {
     struct addrinfo hints, *listp, *p;
     int listenfd, optval=1;
@@ -994,6 +1011,11 @@ int open_listenfd(char *port)
         /* Eliminates "Address already in use" error from bind */
         Setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,    //line:netp:csapp:setsockopt
                    (const void *)&optval , sizeof(int));
+        if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                                    (const void *)&optval, sizeof(int)) < 0) {
+            Close(listenfd);
+            continue;
+        }
 
         /* Bind the descriptor to the address */
         if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
@@ -1036,6 +1058,15 @@ int Open_listenfd(char *port)
     return rc;
 }
 
+int Open_reuseport_listenfd(char *port) 
+{
+    int rc;
+
+    if ((rc = open_reuseport_listenfd(port)) < 0)
+	unix_error("Open_reuseport_listenfd error");
+    return rc;
+}
+
 /* $end csapp.c */
 
 
@@ -0,0 +1,457 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * disk.c
+ * CODE DESCRIPTION
+ *
+ * Disk-backed second tier of the web cache. Objects evicted from memory,
+ * and objects too large for it, are appended as records to fixed-size
+ * segment files in a directory. Each segment is memory-mapped, so
+ * records are written with a memcpy and hits can be sent straight from
+ * the page cache (sendfile, or send from the mapping), without going
+ * through a user-space buffer.
+ *
+ * The tier is a log: records are only ever appended to the newest
+ * segment, and once all DISK_SEGS segments are full the oldest one is
+ * dropped as a whole (FIFO eviction). A dropped segment's file is
+ * unlinked right away, but its mapping lives on until the last hit
+ * pinning it is released.
+ *
+ * Records are found through an in-memory open-addressing index of key
+ * hashes. The full key is kept in the record and compared on lookup.
+ * A counting bloom filter of the indexed hashes sits in front of the
+ * index. It is read without the lock, so most misses never take it.
+ *
+ * One mutex guards the index and the segment list. Appends only hold it
+ * to reserve room and to publish the record; the copy happens unlocked,
+ * with the segment pinned.
+ */
+
+#include "csapp.h"
+#include "disk.h"
+
+/* Size of a record with a key of klen bytes and a size-byte object */
+#define RECORD_SIZE(klen, size) \
+	((sizeof(disk_record_t) + (klen) + 1 + (size) + 7) & ~(size_t)7)
+
+static disk_seg_t *seg_new(disk_t *disk);
+static void seg_retire(disk_t *disk);
+static void seg_release(disk_seg_t *seg);
+static disk_entry_t *index_slot(disk_t *disk, char *key, size_t klen,
+								uint64_t hash);
+static void index_rebuild(disk_t *disk, size_t slots, disk_seg_t *drop);
+static int bloom_test(disk_t *disk, uint64_t hash);
+static void bloom_update(disk_t *disk, uint64_t hash, int delta);
+
+
+/***************************/
+/*** DISK TIER FUNCTIONS ***/
+/***************************/
+
+/*
+ * disk_init - set up an empty disk tier of max_size bytes in dir.
+ *		Returns the tier, or NULL (with a message) if dir is unusable.
+ */
+disk_t* disk_init(char *dir, size_t max_size)
+{
+	disk_t *disk;
+	size_t expected, counters;
+	struct stat st;
+
+	if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode)) {
+		fprintf(stderr, "disk tier: %s is not a directory\n", dir);
+		return NULL;
+	}
+
+	disk = (disk_t *)Calloc(1, sizeof(disk_t));
+	disk->dir = strdup(dir);
+
+	/* Aim for DISK_SEGS segments, within the segment size bounds */
+	disk->seg_size = max_size / DISK_SEGS;
+	if (disk->seg_size < DISK_SEG_MIN)
+		disk->seg_size = DISK_SEG_MIN;
+	if (disk->seg_size > DISK_SEG_MAX)
+		disk->seg_size = DISK_SEG_MAX;
+	disk->nsegs = max_size / disk->seg_size;
+	if (disk->nsegs < 2)
+		disk->nsegs = 2;
+	disk->segs = (disk_seg_t **)Calloc(disk->nsegs, sizeof(disk_seg_t *));
+	/* Keep each object to a quarter segment, so little room is wasted */
+	disk->max_object_size = disk->seg_size / 4;
+
+	expected = max_size / DISK_AVG_OBJECT;
+	for (disk->slots = 64; disk->slots < 2 * expected; disk->slots *= 2)
+		;
+	disk->index = (disk_entry_t *)Calloc(disk->slots, sizeof(disk_entry_t));
+	for (counters = 1024; counters < BLOOM_BITS * expected; counters *= 2)
+		;
+	disk->bloom = (uint8_t *)Calloc(counters, sizeof(uint8_t));
+	disk->bloom_mask = counters - 1;
+
+	pthread_mutex_init(&disk->lock, NULL);
+	return disk;
+}
+
+/*
+ * disk_deinit - drop every segment and free the tier
+ */
+void disk_deinit(disk_t *disk)
+{
+	pthread_mutex_lock(&disk->lock);
+	while (disk->count)
+		seg_retire(disk);
+	pthread_mutex_unlock(&disk->lock);
+
+	pthread_mutex_destroy(&disk->lock);
+	Free(disk->index);
+	Free(disk->bloom);
+	Free(disk->segs);
+	free(disk->dir);
+	Free(disk);
+}
+
+/*
+ * disk_get - look a key up in the disk tier. On a hit, fills in hit
+ *		with the object, pinned until disk_release.
+ *		Returns 0 on a hit, -1 on a miss
+ */
+int disk_get(disk_t *disk, char *key, size_t klen, uint64_t hash,
+			 disk_hit_t *hit)
+{
+	disk_entry_t *e;
+	disk_record_t *rec;
+
+	/* Most misses stop here, without the lock */
+	if (!bloom_test(disk, hash))
+		return -1;
+
+	pthread_mutex_lock(&disk->lock);
+	if (!(e = index_slot(disk, key, klen, hash))->seg) {
+		pthread_mutex_unlock(&disk->lock);
+		return -1;
+	}
+
+	rec = (disk_record_t *)(e->seg->map + e->off);
+	hit->seg = e->seg;
+	hit->off = e->off + sizeof(disk_record_t) + klen + 1;
+	hit->data = e->seg->map + hit->off;
+	hit->size = rec->size;
+	hit->expires = __atomic_load_n(&rec->expires, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&hit->seg->refcnt, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&disk->lock);
+
+	return 0;
+}
+
+/*
+ * disk_release - unpin the segment of a disk tier hit
+ */
+void disk_release(disk_hit_t *hit)
+{
+	seg_release(hit->seg);
+	hit->seg = NULL;
+}
+
+/*
+ * disk_refresh - set a new expiry time on the record of a disk tier hit,
+ *		whose key is klen bytes long, once it has been revalidated
+ */
+void disk_refresh(disk_hit_t *hit, size_t klen, time_t expires)
+{
+	disk_record_t *rec = (disk_record_t *)(hit->data - klen - 1 -
+										   sizeof(disk_record_t));
+
+	__atomic_store_n(&rec->expires, expires, __ATOMIC_RELAXED);
+	hit->expires = expires;
+}
+
+/*
+ * disk_contains - Returns whether the disk tier holds a key
+ */
+int disk_contains(disk_t *disk, char *key, size_t klen, uint64_t hash)
+{
+	int found;
+
+	if (!bloom_test(disk, hash))
+		return 0;
+
+	pthread_mutex_lock(&disk->lock);
+	found = (index_slot(disk, key, klen, hash)->seg != NULL);
+	pthread_mutex_unlock(&disk->lock);
+
+	return found;
+}
+
+/*
+ * disk_put - append an object, fresh until expires, to the disk tier,
+ *		replacing any record held for its key. Objects over
+ *		max_object_size are not stored.
+ */
+void disk_put(disk_t *disk, char *key, size_t klen, uint64_t hash,
+			  obj_t *obj, time_t expires)
+{
+	size_t off, pos, len = RECORD_SIZE(klen, obj->len);
+	disk_seg_t *seg;
+	disk_record_t rec;
+	disk_entry_t *e;
+	obj_seg_t *part;
+
+	if (obj->len > disk->max_object_size)
+		return;
+
+	/* Reserve room in the newest segment, starting a new one if full */
+	pthread_mutex_lock(&disk->lock);
+	seg = disk->count ? disk->segs[disk->count - 1] : NULL;
+	if ((!seg || seg->used + len > seg->size) && !(seg = seg_new(disk))) {
+		pthread_mutex_unlock(&disk->lock);
+		return;
+	}
+	off = seg->used;
+	seg->used += len;
+	__atomic_add_fetch(&seg->refcnt, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&disk->lock);
+
+	/* Write the record through the mapping */
+	rec.magic = DISK_MAGIC;
+	rec.klen = klen;
+	rec.size = obj->len;
+	rec.hash = hash;
+	rec.expires = expires;
+	memcpy(seg->map + off, &rec, sizeof(rec));
+	memcpy(seg->map + off + sizeof(rec), key, klen + 1);
+	pos = off + sizeof(rec) + klen + 1;
+	for (part = obj->hd; part; part = part->next)
+	{
+		memcpy(seg->map + pos, part->data, part->len);
+		pos += part->len;
+	}
+
+	/* Publish it, unless its segment was dropped meanwhile */
+	pthread_mutex_lock(&disk->lock);
+	if (seg->live)
+	{
+		if (2 * (disk->nentries + 1) > disk->slots)
+			index_rebuild(disk, 2 * disk->slots, NULL);
+		e = index_slot(disk, key, klen, hash);
+		if (!e->seg) {
+			disk->nentries++;
+			bloom_update(disk, hash, 1);
+		}
+		e->hash = hash;
+		e->seg = seg;
+		e->off = off;
+	}
+	pthread_mutex_unlock(&disk->lock);
+	seg_release(seg);
+}
+
+/*******************************/
+/*** END DISK TIER FUNCTIONS ***/
+/*******************************/
+
+
+/*************************/
+/*** SEGMENT FUNCTIONS ***/
+/*************************/
+
+/*
+ * seg_new - create a new, empty segment at the end of the log, dropping
+ *		the oldest one if the log is full. Called with the lock held.
+ *		Returns the segment, NULL (with a message) on error.
+ */
+static disk_seg_t *seg_new(disk_t *disk)
+{
+	disk_seg_t *seg;
+	char path[MAXLINE];
+
+	if (disk->count == disk->nsegs)
+		seg_retire(disk);
+
+	seg = (disk_seg_t *)Calloc(1, sizeof(disk_seg_t));
+	seg->id = disk->next_id++;
+	seg->size = disk->seg_size;
+	snprintf(path, MAXLINE, "%s/seg.%u", disk->dir, seg->id);
+
+	/* Reserve the file's blocks up front: stores into a sparse file
+	 * through the mapping would raise SIGBUS once the disk is full
+	 */
+	if ((seg->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0 ||
+		(errno = posix_fallocate(seg->fd, 0, seg->size)) ||
+		(seg->map = mmap(NULL, seg->size, PROT_READ | PROT_WRITE,
+						 MAP_SHARED, seg->fd, 0)) == MAP_FAILED)
+	{
+		fprintf(stderr, "disk tier: %s: %s\n", path, strerror(errno));
+		if (seg->fd >= 0) {
+			close(seg->fd);
+			unlink(path);
+		}
+		Free(seg);
+		return NULL;
+	}
+
+	seg->live = 1;
+	seg->refcnt = 1; // The tier's reference
+	disk->segs[disk->count++] = seg;
+	return seg;
+}
+
+/*
+ * seg_retire - drop the oldest segment: unindex its records, unlink its
+ *		file and drop the tier's reference. Called with the lock held.
+ */
+static void seg_retire(disk_t *disk)
+{
+	disk_seg_t *seg = disk->segs[0];
+	char path[MAXLINE];
+
+	index_rebuild(disk, disk->slots, seg);
+
+	disk->count--;
+	memmove(disk->segs, disk->segs + 1, disk->count * sizeof(disk_seg_t *));
+
+	snprintf(path, MAXLINE, "%s/seg.%u", disk->dir, seg->id);
+	unlink(path);
+	seg->live = 0;
+	seg_release(seg);
+}
+
+/*
+ * seg_release - drop a reference to a segment, unmapping and freeing it
+ *		with the last one
+ */
+static void seg_release(disk_seg_t *seg)
+{
+	if (__atomic_sub_fetch(&seg->refcnt, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	munmap(seg->map, seg->size);
+	close(seg->fd);
+	Free(seg);
+}
+
+/*****************************/
+/*** END SEGMENT FUNCTIONS ***/
+/*****************************/
+
+
+/***********************/
+/*** INDEX FUNCTIONS ***/
+/***********************/
+
+/*
+ * index_slot - return the index slot of the record held for key, or the
+ *		empty slot where it would go. Called with the lock held.
+ */
+static disk_entry_t *index_slot(disk_t *disk, char *key, size_t klen,
+								uint64_t hash)
+{
+	size_t mask = disk->slots - 1;
+	size_t i;
+	disk_entry_t *e;
+	disk_record_t *rec;
+
+	for (i = hash & mask; (e = &disk->index[i])->seg; i = (i + 1) & mask)
+	{
+		if (e->hash != hash)
+			continue;
+		/* Only compare keys when the hashes match */
+		rec = (disk_record_t *)(e->seg->map + e->off);
+		if (rec->klen == klen &&
+			!memcmp((char *)(rec + 1), key, klen))
+			return e;
+	}
+
+	return e;
+}
+
+/*
+ * index_rebuild - rebuild the index with the given number of slots,
+ *		leaving out the records of segment drop (if not NULL). Records
+ *		are only ever dropped a segment at a time, so this is the only
+ *		way out of the index. Called with the lock held.
+ */
+static void index_rebuild(disk_t *disk, size_t slots, disk_seg_t *drop)
+{
+	disk_entry_t *old = disk->index;
+	size_t old_slots = disk->slots;
+	size_t mask, i, j;
+
+	disk->slots = slots;
+	disk->index = (disk_entry_t *)Calloc(slots, sizeof(disk_entry_t));
+	mask = slots - 1;
+
+	for (i = 0; i < old_slots; i++)
+	{
+		if (!old[i].seg)
+			continue;
+		if (old[i].seg == drop) {
+			disk->nentries--;
+			bloom_update(disk, old[i].hash, -1);
+			continue;
+		}
+		for (j = old[i].hash & mask; disk->index[j].seg; j = (j + 1) & mask)
+			;
+		disk->index[j] = old[i];
+	}
+
+	Free(old);
+}
+
+/***************************/
+/*** END INDEX FUNCTIONS ***/
+/***************************/
+
+
+/***********************/
+/*** BLOOM FUNCTIONS ***/
+/***********************/
+
+/*
+ * bloom_test - Returns whether hash may be in the index (0 means it
+ *		certainly is not). Safe without the lock.
+ */
+static int bloom_test(disk_t *disk, uint64_t hash)
+{
+	int i;
+	uint8_t *c;
+	uint64_t h2 = (hash >> 32) | 1;
+
+	for (i = 0; i < BLOOM_HASHES; i++)
+	{
+		c = &disk->bloom[(hash + i * h2) & disk->bloom_mask];
+		if (!__atomic_load_n(c, __ATOMIC_RELAXED))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * bloom_update - add (delta 1) or remove (delta -1) a hash from the
+ *		counting bloom filter. Saturated counters stay put, as their
+ *		true count is lost. Called with the lock held.
+ */
+static void bloom_update(disk_t *disk, uint64_t hash, int delta)
+{
+	int i;
+	uint8_t *c;
+	uint64_t h2 = (hash >> 32) | 1;
+
+	for (i = 0; i < BLOOM_HASHES; i++)
+	{
+		c = &disk->bloom[(hash + i * h2) & disk->bloom_mask];
+		if (*c != UINT8_MAX)
+			__atomic_store_n(c, *c + delta, __ATOMIC_RELAXED);
+	}
+}
+
+/***************************/
+/*** END BLOOM FUNCTIONS ***/
+/***************************/
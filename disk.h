@@ -0,0 +1,109 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * disk.h
+ * CODE DESCRIPTION
+ *
+ * Header for disk.c
+ */
+
+#ifndef __DISK_H__
+#define __DISK_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "obj.h"
+
+/* Default size of the disk tier */
+#define DEF_DISK_SIZE (1024UL * 1024 * 1024)
+
+/* Bounds on the segment size, and the number of segments aimed for */
+#define DISK_SEG_MIN (1024 * 1024)
+#define DISK_SEG_MAX (64 * 1024 * 1024)
+#define DISK_SEGS 16
+
+/* Average object size assumed when sizing the index and bloom filter */
+#define DISK_AVG_OBJECT 8192
+
+/* Bloom filter counters per expected object, and hashes per key */
+#define BLOOM_BITS 8
+#define BLOOM_HASHES 4
+
+/* Marks the start of a record */
+#define DISK_MAGIC 0x70787963
+
+/* Record header, followed by the key (with its NUL) and the object */
+typedef struct DiskRecord {
+	uint32_t magic;		// DISK_MAGIC
+	uint32_t klen;		// Length of the key
+	uint64_t size;		// Size of the object
+	uint64_t hash;		// Hash of the key
+	int64_t expires;	// When the object goes stale
+} disk_record_t;
+
+/* Segment: a fixed-size file of records, written once, front to back */
+typedef struct DiskSeg {
+	unsigned id;		// Number in the file name
+	int fd;
+	char *map;			// Shared mapping of the whole file
+	size_t size;		// Size of the file
+	size_t used;		// Bytes handed out to records
+	int live;			// Whether the disk tier still holds it
+	int refcnt;			// The tier's reference, plus one per pin
+} disk_seg_t;
+
+/* Index entry; empty when seg is NULL */
+typedef struct DiskEntry {
+	uint64_t hash;		// Hash of the key
+	disk_seg_t *seg;	// Segment holding the record
+	size_t off;			// Offset of the record in the segment
+} disk_entry_t;
+
+/* Disk tier hit: an object pinned in its segment until disk_release */
+typedef struct DiskHit {
+	disk_seg_t *seg;
+	char *data;			// Object, in the segment's mapping
+	size_t off;			// Offset of the object in the segment file
+	size_t size;		// Size of the object
+	time_t expires;		// When it goes stale
+} disk_hit_t;
+
+/* Disk tier: a log of segments, oldest recycled first, with an
+ * in-memory index of the records and a bloom filter in front of it
+ */
+typedef struct Disk {
+	char *dir;			// Directory of the segment files
+	size_t seg_size;	// Size of each segment
+	size_t max_object_size; // Largest object that fits in a segment
+	int nsegs;			// Most segments kept
+	disk_seg_t **segs;	// Live segments, oldest first
+	int count;			// Number of live segments
+	unsigned next_id;	// Id of the next segment
+	disk_entry_t *index; // Open-addressing (linear probing) index
+	size_t slots;		// Number of index slots, a power of 2
+	size_t nentries;	// Number of indexed records
+	uint8_t *bloom;		// Counting bloom filter of the indexed hashes
+	size_t bloom_mask;	// Number of counters - 1
+	pthread_mutex_t lock; // Guards everything but the bloom filter reads
+} disk_t;
+
+/* Disk tier functions */
+disk_t* disk_init(char *dir, size_t max_size);
+void disk_deinit(disk_t *disk);
+int disk_get(disk_t *disk, char *key, size_t klen, uint64_t hash,
+			 disk_hit_t *hit);
+void disk_release(disk_hit_t *hit);
+void disk_refresh(disk_hit_t *hit, size_t klen, time_t expires);
+int disk_contains(disk_t *disk, char *key, size_t klen, uint64_t hash);
+void disk_put(disk_t *disk, char *key, size_t klen, uint64_t hash,
+			  obj_t *obj, time_t expires);
+
+#endif /* __DISK_H__ */
@@ -0,0 +1,531 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * flight.c
+ * CODE DESCRIPTION
+ *
+ * Request collapsing (single-flight). The first client to miss on a key
+ * becomes the leader of a flight: it fetches the object from the origin
+ * as usual, and also appends the response to the flight as it arrives.
+ * Clients missing on the same key meanwhile join the flight as followers
+ * instead of fetching it again. Each one streams the response from the
+ * start, at its own pace, while it is still being read in. Only the
+ * leader adds the object to the cache.
+ *
+ * Each shard has a small hash table of its flights, guarded by its own
+ * mutex. A flight leaves the table when the leader finishes, once the
+ * object is in the cache, so later misses go to the origin again.
+ *
+ * The response is kept in a list of chunks that are filled in order and
+ * never moved. Followers keep a pointer into them, and write to their
+ * clients without holding the flight's lock. Threaded followers wait on
+ * the flight's condition variable. Event-loop followers cannot block, so
+ * they register an eventfd that the leader writes to on progress, and
+ * wait for it like any other fd.
+ *
+ * Nothing is copied for no one: until a follower joins, the response
+ * is only counted, the leader's web object holding it meanwhile, and the
+ * chunks are seeded from that object once one does. A response larger
+ * than the cache would keep leaves the table once past that size, so
+ * misses from then on fetch it themselves, and is no longer kept at all
+ * if no follower has joined by then.
+ * Otherwise only the chunks some follower still needs are kept from then
+ * on, each chunk counting the followers positioned in it, and no more
+ * than that size: the leader waits for followers lagging further behind
+ * to catch up before reading more, as it waits for its own client.
+ *
+ * Followers that joined on the key of a URL may have asked for another
+ * variant of it than the leader's response turns out to be (Vary). So
+ * they get none of the response until the leader has read its head and
+ * told which variant it is, for them to check against their request.
+ * A response the cache may not keep (private, no-store, Vary: *, ...)
+ * was made for the leader's request alone, credentials and cookies
+ * included, so followers never get it: they fetch the object themselves.
+ */
+
+#include "csapp.h"
+#include "flight.h"
+
+static void flight_unpublish(flight_t *f);
+static void flight_drop(flight_t *f);
+static void flight_copy(flight_t *f, char *data, size_t n);
+static void flight_trim(flight_t *f);
+static void flight_notify(flight_t *f);
+
+
+/************************/
+/*** LEADER FUNCTIONS ***/
+/************************/
+
+/*
+ * flight_join - join the flight fetching key, or start one if there is
+ *		none, in which case *leader is set and the caller must fetch the
+ *		object, then call flight_finish.
+ *		Returns the flight, pinned until released.
+ */
+flight_t* flight_join(cache_t *cache, cache_key_t *key, int *leader)
+{
+	shard_t *shard = cache_shard(cache, key->hash);
+	flight_t *f, **bucket = &shard->flights[key->hash & (FLIGHT_BUCKETS - 1)];
+
+	pthread_mutex_lock(&shard->flight_lock);
+	for (f = *bucket; f; f = f->next)
+	{
+		if (f->key.hash == key->hash && f->key.len == key->len &&
+			!memcmp(f->key.str, key->str, key->len))
+		{
+			__atomic_add_fetch(&f->refcnt, 1, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&shard->flight_lock);
+			*leader = 0;
+			return f;
+		}
+	}
+
+	/* No one is fetching it yet: lead a new flight */
+	f = (flight_t *)Calloc(1, sizeof(flight_t));
+	f->key.str = (char *)Malloc(key->len + 1);
+	memcpy(f->key.str, key->str, key->len + 1);
+	f->key.len = key->len;
+	f->key.hash = key->hash;
+	f->refcnt = 1;
+	f->published = 1;
+	f->state = FLIGHT_RUNNING;
+	f->shard = shard;
+	pthread_mutex_init(&f->lock, NULL);
+	pthread_cond_init(&f->cond, NULL);
+	f->next = *bucket;
+	*bucket = f;
+	pthread_mutex_unlock(&shard->flight_lock);
+
+	*leader = 1;
+	return f;
+}
+
+/*
+ * flight_append - add the next n bytes of the response to the flight,
+ *		and wake its followers. obj is the leader's web object, holding
+ *		the response so far, these bytes included, or NULL if it does not
+ *		(any more)
+ */
+void flight_append(cache_t *cache, flight_t *f, obj_t *obj, char *data,
+				   size_t n)
+{
+	obj_seg_t *seg;
+
+	if (f->dropped)
+		return;
+
+	/* Too big to keep for later joiners */
+	if (f->published && f->len + n > cache->max_fill_size)
+		flight_unpublish(f);
+
+	/* Copy nothing for no one: while no follower has joined, the
+	 * leader's object is the only copy, to seed the chunks from once
+	 * one does; without it, or past the size it would keep, stop
+	 * keeping the response at all
+	 */
+	if (!f->copying) {
+		if (!flight_followers(f) && obj && f->published) {
+			f->len += n;
+			return;
+		}
+		if (!flight_followers(f) ||
+			(f->len && (!obj || obj->len != f->len + n))) {
+			flight_drop(f);
+			return;
+		}
+	}
+
+	pthread_mutex_lock(&f->lock);
+	if (!f->published)
+		flight_trim(f);
+	if (!f->copying && f->len) {
+		f->len = 0;
+		for (seg = obj->hd; seg; seg = seg->next)
+			flight_copy(f, seg->data, seg->len);
+	}
+	else
+		flight_copy(f, data, n);
+	f->copying = 1;
+	flight_notify(f);
+	pthread_mutex_unlock(&f->lock);
+}
+
+/*
+ * flight_variant - tell the followers, once the head of the response is
+ *		in, the key it is cached under, and let them have it; or, with
+ *		key NULL, that it may not be cached, nor shared with them
+ */
+void flight_variant(flight_t *f, char *key)
+{
+	pthread_mutex_lock(&f->lock);
+	if (!f->head) {
+		f->head = 1;
+		f->pass = !key;
+		if (key && strcmp(key, f->key.str)) {
+			f->variant = (char *)Malloc(strlen(key) + 1);
+			strcpy(f->variant, key);
+		}
+		flight_notify(f);
+	}
+	pthread_mutex_unlock(&f->lock);
+}
+
+/*
+ * flight_room - check, before reading more of a response too big for the
+ *		cache, that the flight keeps no more of it than the cache would
+ *		for followers lagging behind, once it drops what they have all
+ *		read; or else wait for them to read on, if wait is set.
+ *		Returns 1 if there is room for more, 0 if not, in which case the
+ *		flight's eventfds are written to once there may be.
+ */
+int flight_room(cache_t *cache, flight_t *f, int wait)
+{
+	int room;
+
+	if (f->published || f->dropped)
+		return 1;
+
+	pthread_mutex_lock(&f->lock);
+	while (1)
+	{
+		flight_trim(f);
+		/* Followers still need more than the chunk being filled */
+		room = (f->kept <= cache->max_fill_size || f->hd == f->tl);
+		if (room || !wait)
+			break;
+		f->waiting = 1;
+		pthread_cond_wait(&f->cond, &f->lock);
+	}
+	f->waiting = !room;
+	pthread_mutex_unlock(&f->lock);
+
+	return room;
+}
+
+/*
+ * flight_finish - end the leader's fetch, successful (ok) or not, once
+ *		the object (if any) is in the cache. Wakes the followers so
+ *		they can finish, and releases the leader's reference.
+ */
+void flight_finish(flight_t *f, int ok)
+{
+	flight_unpublish(f);
+
+	pthread_mutex_lock(&f->lock);
+	/* A follower that joined after the last bytes were read has none
+	 * of them copied: send it off to fetch the object itself
+	 */
+	if (!f->copying && f->len)
+		f->dropped = 1;
+	f->state = (ok && !f->dropped) ? FLIGHT_DONE : FLIGHT_FAILED;
+	flight_notify(f);
+	pthread_mutex_unlock(&f->lock);
+
+	flight_release(f);
+}
+
+/*
+ * flight_followers - Returns the number of followers of a flight
+ */
+int flight_followers(flight_t *f)
+{
+	return __atomic_load_n(&f->refcnt, __ATOMIC_ACQUIRE) - 1;
+}
+
+/****************************/
+/*** END LEADER FUNCTIONS ***/
+/****************************/
+
+
+/**************************/
+/*** FOLLOWER FUNCTIONS ***/
+/**************************/
+
+/*
+ * flight_read - get the next part of the response after pos, advancing
+ *		pos past it, and waiting for it if wait is set. *data points
+ *		into the flight, valid until released. Nothing is handed out
+ *		before the leader has told the variant (flight_variant), nor
+ *		ever if the response is not to be shared. A follower must call
+ *		flight_unfollow once done reading.
+ *		Returns the number of bytes at *data; 0 at the end of a complete
+ *		response; -1 if the fetch failed; FLIGHT_PASS if the response is
+ *		not to be shared; FLIGHT_AGAIN if nothing new has arrived and
+ *		wait is not set
+ */
+ssize_t flight_read(flight_t *f, flight_pos_t *pos, char **data, int wait)
+{
+	ssize_t n;
+	flight_chunk_t *c;
+
+	pthread_mutex_lock(&f->lock);
+	while (1)
+	{
+		/* Move on to the next chunk once this one is read */
+		c = pos->chunk ? pos->chunk : f->hd;
+		if (c && pos->off == c->len && c->next) {
+			c = c->next;
+			pos->off = 0;
+		}
+
+		if (c && pos->off < c->len && f->head && !f->pass) {
+			*data = c->data + pos->off;
+			n = c->len - pos->off;
+			/* Leaving the first chunk kept, or starting, may let the
+			 * leader drop it
+			 */
+			if (pos->chunk != c) {
+				if (f->waiting && (!pos->chunk || pos->chunk == f->hd))
+					flight_notify(f);
+				if (pos->chunk)
+					pos->chunk->refs--;
+				else
+					f->started++;
+				c->refs++;
+				pos->chunk = c;
+			}
+			pos->off = c->len;
+			pos->read += n;
+			break;
+		}
+
+		/* A response that may not be cached, or that ended before the
+		 * leader could tell, is for the leader's client alone; so is
+		 * one not kept, or a fetch given up on before it started
+		 */
+		if (!pos->chunk && (f->pass || f->dropped ||
+							(c && f->state != FLIGHT_RUNNING))) {
+			n = FLIGHT_PASS;
+			break;
+		}
+		if (f->state != FLIGHT_RUNNING) {
+			n = (f->state == FLIGHT_DONE) ? 0 : -1;
+			break;
+		}
+		if (!wait) {
+			n = FLIGHT_AGAIN;
+			break;
+		}
+		pthread_cond_wait(&f->cond, &f->lock);
+	}
+	pthread_mutex_unlock(&f->lock);
+
+	return n;
+}
+
+/*
+ * flight_watch - have the leader write to eventfd fd whenever there is
+ *		progress, for followers that wait for it in an event loop
+ */
+void flight_watch(flight_t *f, int fd)
+{
+	pthread_mutex_lock(&f->lock);
+	if (f->nwake == f->wake_cap) {
+		f->wake_cap = f->wake_cap ? 2 * f->wake_cap : 4;
+		f->wake_fds = (int *)Realloc(f->wake_fds, f->wake_cap * sizeof(int));
+	}
+	f->wake_fds[f->nwake++] = fd;
+	pthread_mutex_unlock(&f->lock);
+}
+
+/*
+ * flight_unwatch - stop writing to eventfd fd; it may be closed after
+ */
+void flight_unwatch(flight_t *f, int fd)
+{
+	int i;
+
+	pthread_mutex_lock(&f->lock);
+	for (i = 0; i < f->nwake; i++)
+	{
+		if (f->wake_fds[i] == fd) {
+			f->wake_fds[i] = f->wake_fds[--f->nwake];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&f->lock);
+}
+
+/*
+ * flight_unfollow - stop reading a flight's response from pos, letting
+ *		the leader drop the chunks only this follower still needed
+ */
+void flight_unfollow(flight_t *f, flight_pos_t *pos)
+{
+	pthread_mutex_lock(&f->lock);
+	if (pos->read)
+		f->started--;
+	if (pos->chunk)
+		pos->chunk->refs--;
+	pos->chunk = NULL;
+	if (f->waiting)
+		flight_notify(f);
+	pthread_mutex_unlock(&f->lock);
+}
+
+/*
+ * flight_release - drop a reference to a flight, freeing it and its
+ *		response with the last one
+ */
+void flight_release(flight_t *f)
+{
+	flight_chunk_t *c;
+	int left;
+
+	/* A follower leaving may let the leader drop what it waited on */
+	pthread_mutex_lock(&f->lock);
+	left = __atomic_sub_fetch(&f->refcnt, 1, __ATOMIC_ACQ_REL);
+	if (left && f->waiting)
+		flight_notify(f);
+	pthread_mutex_unlock(&f->lock);
+	if (left)
+		return;
+
+	while ((c = f->hd))
+	{
+		f->hd = c->next;
+		Free(c);
+	}
+	pthread_mutex_destroy(&f->lock);
+	pthread_cond_destroy(&f->cond);
+	if (f->wake_fds)
+		Free(f->wake_fds);
+	if (f->variant)
+		Free(f->variant);
+	Free(f->key.str);
+	Free(f);
+}
+
+/******************************/
+/*** END FOLLOWER FUNCTIONS ***/
+/******************************/
+
+
+/************************/
+/*** HELPER FUNCTIONS ***/
+/************************/
+
+/*
+ * flight_unpublish - take a flight out of its shard's table, so that
+ *		later misses on its key do not join it
+ */
+static void flight_unpublish(flight_t *f)
+{
+	shard_t *shard = f->shard;
+	flight_t **p = &shard->flights[f->key.hash & (FLIGHT_BUCKETS - 1)];
+
+	pthread_mutex_lock(&shard->flight_lock);
+	if (f->published)
+	{
+		while (*p != f)
+			p = &(*p)->next;
+		*p = f->next;
+		f->published = 0;
+	}
+	pthread_mutex_unlock(&shard->flight_lock);
+}
+
+/*
+ * flight_drop - stop keeping the response of a flight, none of which
+ *		was copied for followers, and send any that joined off to fetch
+ *		it themselves
+ */
+static void flight_drop(flight_t *f)
+{
+	flight_unpublish(f);
+
+	pthread_mutex_lock(&f->lock);
+	f->dropped = 1;
+	flight_notify(f);
+	pthread_mutex_unlock(&f->lock);
+}
+
+/*
+ * flight_copy - copy n bytes of data at the end of a flight's response,
+ *		in chunks twice the size of the last one. Called with the
+ *		flight's lock held.
+ */
+static void flight_copy(flight_t *f, char *data, size_t n)
+{
+	size_t cap, chunk;
+	flight_chunk_t *c;
+
+	while (n > 0)
+	{
+		/* Start a new chunk, twice the size of the last one */
+		if (!f->tl || f->tl->len == f->tl->cap)
+		{
+			cap = f->tl ? 2 * f->tl->cap : FLIGHT_CHUNK_MIN;
+			if (cap > FLIGHT_CHUNK_MAX)
+				cap = FLIGHT_CHUNK_MAX;
+			c = (flight_chunk_t *)Malloc(sizeof(flight_chunk_t) + cap);
+			c->next = NULL;
+			c->len = 0;
+			c->cap = cap;
+			c->refs = 0;
+			if (f->tl)
+				f->tl->next = c;
+			else
+				f->hd = c;
+			f->tl = c;
+		}
+
+		chunk = (n < f->tl->cap - f->tl->len) ? n : f->tl->cap - f->tl->len;
+		memcpy(f->tl->data + f->tl->len, data, chunk);
+		f->tl->len += chunk;
+		f->len += chunk;
+		f->kept += chunk;
+		data += chunk;
+		n -= chunk;
+	}
+}
+
+/*
+ * flight_trim - drop the chunks at the start of a response that every
+ *		follower has read past, once all of them have started reading
+ *		it. Called by the leader, with the flight's lock held, once no
+ *		one else can join.
+ */
+static void flight_trim(flight_t *f)
+{
+	flight_chunk_t *c;
+
+	if (f->started < flight_followers(f))
+		return;
+
+	while ((c = f->hd) && !c->refs)
+	{
+		f->hd = c->next;
+		if (!f->hd)
+			f->tl = NULL;
+		f->kept -= c->len;
+		Free(c);
+	}
+}
+
+/*
+ * flight_notify - wake every follower of a flight. Called with the
+ *		flight's lock held.
+ */
+static void flight_notify(flight_t *f)
+{
+	int i;
+	uint64_t one = 1;
+
+	pthread_cond_broadcast(&f->cond);
+	for (i = 0; i < f->nwake; i++)
+		if (write(f->wake_fds[i], &one, sizeof(one)) < 0 && errno != EAGAIN)
+			fprintf(stderr, "flight: eventfd write: %s\n", strerror(errno));
+}
+
+/****************************/
+/*** END HELPER FUNCTIONS ***/
+/****************************/
@@ -0,0 +1,100 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * flight.h
+ * CODE DESCRIPTION
+ *
+ * Header for flight.c
+ */
+
+#ifndef __FLIGHT_H__
+#define __FLIGHT_H__
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "webcache.h"
+
+/* Bounds on the size of a response chunk */
+#define FLIGHT_CHUNK_MIN 4096
+#define FLIGHT_CHUNK_MAX (64 * 1024)
+
+/* flight_read result when nothing new has arrived yet */
+#define FLIGHT_AGAIN (-2)
+/* flight_read result when the response is not to be shared: the
+ * follower must fetch the object itself
+ */
+#define FLIGHT_PASS (-3)
+
+/* Fetch states */
+#define FLIGHT_RUNNING 0
+#define FLIGHT_DONE 1		// The whole response was read
+#define FLIGHT_FAILED 2		// The fetch gave up part-way, or never started
+
+/* Chunk of a response; filled in order and never moved */
+typedef struct FlightChunk {
+	struct FlightChunk *next;
+	size_t len;			// Bytes filled in
+	size_t cap;			// Room in data
+	int refs;			// Followers positioned in it
+	char data[];
+} flight_chunk_t;
+
+/* Follower's position in a response: just after off bytes of chunk
+ * (chunk NULL: at the start)
+ */
+typedef struct FlightPos {
+	flight_chunk_t *chunk;
+	size_t off;
+	size_t read;		// Bytes handed out so far
+} flight_pos_t;
+
+/* Fetch in progress from the origin, shared by every client that
+ * missed on its key meanwhile
+ */
+typedef struct Flight {
+	cache_key_t key;	// Its key, the string owned by the flight
+	int refcnt;			// The leader's, plus one per follower
+	int published;		// Whether new misses can still find it
+	int state;			// FLIGHT_RUNNING, FLIGHT_DONE or FLIGHT_FAILED
+	int dropped;		// Whether the response stopped being kept
+	int copying;		// Whether it is copied into chunks (once followed)
+	int head;			// Whether the leader told which variant it fetches...
+	char *variant;		// ... and its key, if not the flight's (else NULL)
+	int pass;			// Whether the response is not to be shared
+	size_t len;			// Bytes of the response so far
+	size_t kept;		// Bytes of it still kept in chunks
+	int started;		// Followers that have read part of it
+	int waiting;		// Whether the leader waits for them (flight_room)
+	flight_chunk_t *hd;	// First chunk kept
+	flight_chunk_t *tl;	// Chunk being filled
+	int *wake_fds;		// eventfds to write to on progress (reactor)
+	int nwake, wake_cap;
+	pthread_mutex_t lock; // Guards the response, state and wake_fds
+	pthread_cond_t cond;  // Signalled on progress
+	struct Shard *shard; // Shard whose table holds it
+	struct Flight *next; // Next flight in its table bucket
+} flight_t;
+
+/* Leader functions */
+flight_t* flight_join(cache_t *cache, cache_key_t *key, int *leader);
+void flight_append(cache_t *cache, flight_t *f, obj_t *obj, char *data,
+				   size_t n);
+void flight_variant(flight_t *f, char *key);
+int flight_room(cache_t *cache, flight_t *f, int wait);
+void flight_finish(flight_t *f, int ok);
+int flight_followers(flight_t *f);
+/* Follower functions */
+ssize_t flight_read(flight_t *f, flight_pos_t *pos, char **data, int wait);
+void flight_watch(flight_t *f, int fd);
+void flight_unwatch(flight_t *f, int fd);
+void flight_unfollow(flight_t *f, flight_pos_t *pos);
+void flight_release(flight_t *f);
+
+#endif /* __FLIGHT_H__ */
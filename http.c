@@ -0,0 +1,879 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * http.c
+ * CODE DESCRIPTION
+ *
+ * HTTP response parsing, and the freshness model of a shared cache
+ * (RFC 9111). The proxy relays responses byte for byte, and caches them
+ * the same way, so the head is parsed straight out of the buffered
+ * object, which need not be NUL-terminated.
+ *
+ * A response is stored only if its status is final and understood, it
+ * carries no no-store, no-cache or private directive, and it has a
+ * positive freshness lifetime. A response to a request with credentials
+ * (Authorization) must also be marked public, must-revalidate or
+ * s-maxage, as meant for shared caches too. The lifetime comes from
+ * s-maxage, max-age or Expires, in that order. Failing those, it is
+ * guessed: a tenth of the time since Last-Modified (capped), or the
+ * configured default, but only for statuses that are cacheable by
+ * default. The response's age (Date and Age) is taken off, and what is
+ * left gives the absolute time at which the cached copy goes stale.
+ *
+ * A stale copy with a validator (ETag or Last-Modified) is revalidated
+ * with a conditional request rather than fetched again. The headers of
+ * a 304 answer replace the stored ones (but for the body's length), and
+ * the lifetime is worked out again from the updated head.
+ * Within its stale-while-revalidate window, a stale copy is served as
+ * is, while one background fetch refreshes it.
+ *
+ * A response with a Vary header is stored as one variant of its object,
+ * the one selected by the values of the request headers it names; the
+ * names are kept normalized (lowercased, comma-separated) for the cache
+ * to key the variants on. Vary: * rules storing out.
+ *
+ * Clients revalidating their own copy are answered from the stored one:
+ * when their If-None-Match lists its ETag (weakly compared), or, without
+ * If-None-Match, their If-Modified-Since is no older than its
+ * Last-Modified, they get a 304 carrying its validator and freshness
+ * headers instead of the body.
+ *
+ * Range requests are answered from the stored 200 response: a 206 with
+ * the one range asked for, or a multipart/byteranges body for several,
+ * and a 416 when none of them overlaps the body. Requests whose ranges
+ * cannot be parsed, or whose If-Range no longer matches, get the whole
+ * response, as RFC 9110 allows.
+ */
+
+#define _XOPEN_SOURCE 700 // strptime
+#define _DEFAULT_SOURCE // timegm
+#include <limits.h>
+#include "csapp.h"
+#include "http.h"
+
+/* Statuses that may be cached without explicit freshness (RFC 9110) */
+static const int heuristic_statuses[] = {
+	200, 203, 204, 300, 301, 308, 404, 405, 410, 414, 501, 0
+};
+
+static char *next_header(char *buf, char *end, char **name, size_t *nlen,
+						 char **value, size_t *vlen);
+static void parse_cache_control(char *s, size_t n, http_resp_t *resp);
+static long parse_seconds(char *s, size_t n);
+static int parse_ranges(char *s, size_t body, size_t *off, size_t *len);
+static int if_range_holds(http_resp_t *resp, char *if_range);
+static int partial_printf(http_partial_t *p, size_t *pos, const char *fmt, ...);
+static int etag_listed(http_resp_t *resp, char *list);
+static void parse_vary(char *s, size_t n, http_resp_t *resp);
+static int has_credentials(char *req);
+static int header_listed(const char **list, char *name, size_t nlen);
+static int carries_header(char *buf, char *end, char *name, size_t nlen);
+
+/* Headers a 304 reply carries over from the stored response (RFC 9110) */
+static const char *not_modified_headers[] = {
+	"Cache-Control", "Content-Location", "Date", "ETag", "Expires",
+	"Last-Modified", "Vary", NULL
+};
+
+/* Headers of a 304 answer that do not update the stored response: the
+ * length of its body, and those about the connection (RFC 9111 3.1, 3.2)
+ */
+static const char *kept_headers[] = {
+	"Connection", "Content-Length", "Keep-Alive", "Proxy-Connection",
+	"TE", "Transfer-Encoding", "Upgrade", NULL
+};
+
+/* Sequence number making multipart/byteranges boundaries unique */
+static unsigned boundary_seq;
+
+
+/**************************/
+/*** RESPONSE FUNCTIONS ***/
+/**************************/
+
+/*
+ * http_parse_response - parse the status line and headers at the start
+ *		of a response of len bytes into resp.
+ *		Returns 0 on success; -1 if the head is not all there yet, or is
+ *		not an HTTP response (resp->status is 0 then).
+ */
+int http_parse_response(char *obj, size_t len, http_resp_t *resp)
+{
+	char *buf, *end, *name, *value;
+	size_t i, nlen, vlen;
+
+	memset(resp, 0, sizeof(http_resp_t));
+	resp->date = resp->expires = resp->last_modified = -1;
+	resp->max_age = resp->s_maxage = resp->swr = -1;
+
+	/* The head ends with an empty line */
+	for (i = 0; i < len; i++)
+	{
+		if (obj[i] != '\n')
+			continue;
+		if (i + 1 < len && obj[i + 1] == '\n') {
+			resp->head_len = i + 2;
+			break;
+		}
+		if (i + 2 < len && obj[i + 1] == '\r' && obj[i + 2] == '\n') {
+			resp->head_len = i + 3;
+			break;
+		}
+	}
+	if (!resp->head_len)
+		return -1;
+	end = obj + resp->head_len;
+
+	/* Status line: HTTP/x.y NNN reason */
+	if (strncmp(obj, "HTTP/", 5) || !(buf = memchr(obj, ' ', end - obj)) ||
+		end - buf < 4 || !isdigit(buf[1]) || !isdigit(buf[2]) ||
+		!isdigit(buf[3]))
+		return -1;
+	resp->status = (buf[1] - '0') * 100 + (buf[2] - '0') * 10 + (buf[3] - '0');
+	buf = memchr(buf, '\n', end - buf) + 1;
+
+	/* Headers the freshness model looks at */
+	while ((buf = next_header(buf, end, &name, &nlen, &value, &vlen)))
+	{
+		if (nlen == 13 && !strncasecmp(name, "Cache-Control", 13))
+			parse_cache_control(value, vlen, resp);
+		else if (nlen == 4 && !strncasecmp(name, "Date", 4))
+			http_parse_date(value, vlen, &resp->date);
+		else if (nlen == 7 && !strncasecmp(name, "Expires", 7) &&
+				 http_parse_date(value, vlen, &resp->expires) < 0)
+			resp->expires = 0;
+		else if (nlen == 13 && !strncasecmp(name, "Last-Modified", 13) &&
+				 !http_parse_date(value, vlen, &resp->last_modified)) {
+			resp->lastmod = value;
+			resp->lastmod_len = vlen;
+		}
+		else if (nlen == 4 && !strncasecmp(name, "ETag", 4) && vlen) {
+			resp->etag = value;
+			resp->etag_len = vlen;
+		}
+		else if (nlen == 3 && !strncasecmp(name, "Age", 3))
+			resp->age = parse_seconds(value, vlen);
+		else if (nlen == 4 && !strncasecmp(name, "Vary", 4))
+			parse_vary(value, vlen, resp);
+	}
+
+	return 0;
+}
+
+/*
+ * http_freshness - decide whether a shared cache may store a response
+ *		received now to a request (req, its request line and headers),
+ *		and if so, work out when it goes stale (*expires). default_ttl
+ *		is the lifetime given to responses that may be cached by default
+ *		but state none (0 to not cache them).
+ *		Returns 1 if the response may be stored, 0 otherwise
+ */
+int http_freshness(http_resp_t *resp, char *req, time_t now,
+				   time_t default_ttl, time_t *expires)
+{
+	int i, heuristic = 0;
+	time_t lifetime, age;
+
+	/* Only complete, final answers; and nothing the origin keeps out
+	 * of shared caches
+	 */
+	if (resp->status < 200 || resp->status > 599 || resp->status == 206 ||
+		resp->status == 304 || resp->vary_all ||
+		(resp->cc & (CC_NO_STORE | CC_NO_CACHE | CC_PRIVATE)))
+		return 0;
+
+	/* An answer to a request with credentials may be meant for that
+	 * user alone, unless the origin says otherwise (RFC 9111, 3.5)
+	 */
+	if (has_credentials(req) && resp->s_maxage < 0 &&
+		!(resp->cc & (CC_PUBLIC | CC_MUST_REVALIDATE)))
+		return 0;
+
+	for (i = 0; heuristic_statuses[i]; i++)
+		if (heuristic_statuses[i] == resp->status)
+			heuristic = 1;
+
+	/* Explicit lifetime first, then a guess if allowed */
+	if (resp->s_maxage >= 0)
+		lifetime = resp->s_maxage;
+	else if (resp->max_age >= 0)
+		lifetime = resp->max_age;
+	else if (resp->expires >= 0)
+		lifetime = resp->expires - ((resp->date >= 0) ? resp->date : now);
+	else if (!heuristic && !(resp->cc & CC_PUBLIC))
+		return 0;
+	else if (resp->last_modified >= 0 && resp->date > resp->last_modified) {
+		lifetime = (resp->date - resp->last_modified) / 10;
+		if (lifetime > MAX_HEURISTIC_TTL)
+			lifetime = MAX_HEURISTIC_TTL;
+	}
+	else
+		lifetime = default_ttl;
+
+	/* Take off the time it already spent in caches and in transit */
+	age = (resp->date >= 0 && now > resp->date) ? now - resp->date : 0;
+	if (resp->age > age)
+		age = resp->age;
+
+	if (lifetime <= age)
+		return 0;
+	*expires = now + lifetime - age;
+	return 1;
+}
+
+/*
+ * http_stale_window - how long after going stale a stored response may
+ *		still be served while it is revalidated in the background
+ *		(RFC 5861): its stale-while-revalidate, or else default_swr.
+ *		Never, if it must be revalidated first.
+ */
+long http_stale_window(http_resp_t *resp, long default_swr)
+{
+	if (resp->cc & CC_MUST_REVALIDATE)
+		return 0;
+
+	return (resp->swr >= 0) ? resp->swr : default_swr;
+}
+
+/*
+ * http_merge - write into out (n bytes) the head of a stored response
+ *		(stored, len bytes), updated with the headers of a 304 (Not
+ *		Modified) answer to its revalidation (resp, resp_len bytes), as
+ *		RFC 9111 4.3.4 asks: each header the 304 carries replaces those
+ *		of that name, but for kept_headers. Its Age, if any, replaces the
+ *		stored one, which is stale. Header lines are copied as they are,
+ *		so the new head is never longer than both together.
+ *		Returns its length; 0 if either head is incomplete, or the new
+ *		one does not fit.
+ */
+size_t http_merge(char *stored, size_t len, char *resp, size_t resp_len,
+				  char *out, size_t n)
+{
+	http_resp_t s, r;
+	char *buf, *end, *rend, *line, *name, *value;
+	size_t nlen, vlen, pos;
+
+	if (http_parse_response(stored, len, &s) < 0 ||
+		http_parse_response(resp, resp_len, &r) < 0 ||
+		s.head_len + r.head_len > n)
+		return 0;
+	end = stored + s.head_len;
+	rend = resp + r.head_len;
+
+	/* Stored status line, and the headers the 304 does not replace */
+	buf = memchr(stored, '\n', end - stored) + 1;
+	memcpy(out, stored, (pos = buf - stored));
+	while ((line = buf) &&
+		   (buf = next_header(buf, end, &name, &nlen, &value, &vlen)))
+	{
+		if ((nlen == 3 && !strncasecmp(name, "Age", 3)) ||
+			(!header_listed(kept_headers, name, nlen) &&
+			 carries_header(resp, rend, name, nlen)))
+			continue;
+		memcpy(out + pos, line, buf - line);
+		pos += buf - line;
+	}
+
+	/* Then those of the 304 */
+	buf = memchr(resp, '\n', rend - resp) + 1;
+	while ((line = buf) &&
+		   (buf = next_header(buf, rend, &name, &nlen, &value, &vlen)))
+	{
+		if (header_listed(kept_headers, name, nlen))
+			continue;
+		memcpy(out + pos, line, buf - line);
+		pos += buf - line;
+	}
+	memcpy(out + pos, "\r\n", 2);
+
+	return pos + 2;
+}
+
+/*
+ * http_conditional - write the headers of a conditional request that
+ *		revalidates a stored response (If-None-Match with its ETag,
+ *		If-Modified-Since with its Last-Modified) into hdrs (n bytes).
+ *		Returns their length; 0 if the response has no validator, or
+ *		they do not fit.
+ */
+int http_conditional(http_resp_t *resp, char *hdrs, size_t n)
+{
+	size_t len = 0;
+
+	if (resp->etag)
+		len += snprintf(hdrs, n, "If-None-Match: %.*s\r\n",
+						(int)resp->etag_len, resp->etag);
+	if (resp->lastmod && len < n)
+		len += snprintf(hdrs + len, n - len, "If-Modified-Since: %.*s\r\n",
+						(int)resp->lastmod_len, resp->lastmod);
+
+	return (len < n) ? len : 0;
+}
+
+/*
+ * http_not_modified - check the validators of a client request (inm and
+ *		ims: its If-None-Match and If-Modified-Since values, empty if
+ *		absent) against a stored response, the first len bytes of which
+ *		are at obj. If they show the client has it already, write a 304
+ *		(Not Modified) reply into out (n bytes).
+ *		Returns the length of the reply; 0 if the whole response should
+ *		be sent instead.
+ */
+size_t http_not_modified(char *obj, size_t len, char *inm, char *ims,
+						 char *out, size_t n)
+{
+	http_resp_t resp;
+	char *buf, *end, *name, *value;
+	size_t nlen, vlen, pos;
+	time_t since;
+
+	if ((!*inm && !*ims) || http_parse_response(obj, len, &resp) < 0 ||
+		resp.status != 200)
+		return 0;
+
+	/* If-None-Match, if given, overrides If-Modified-Since */
+	if (*inm && !etag_listed(&resp, inm))
+		return 0;
+	if (!*inm && (resp.last_modified < 0 ||
+				  http_parse_date(ims, strlen(ims), &since) < 0 ||
+				  resp.last_modified > since))
+		return 0;
+
+	end = obj + resp.head_len;
+	buf = memchr(obj, '\n', end - obj) + 1;
+	pos = snprintf(out, n, "%.*s 304 Not Modified\r\n",
+				   (int)((char *)memchr(obj, ' ', end - obj) - obj), obj);
+	while (pos < n &&
+		   (buf = next_header(buf, end, &name, &nlen, &value, &vlen)))
+	{
+		if (header_listed(not_modified_headers, name, nlen))
+			pos += snprintf(out + pos, n - pos, "%.*s: %.*s\r\n",
+							(int)nlen, name, (int)vlen, value);
+	}
+	if (pos < n)
+		pos += snprintf(out + pos, n - pos, "\r\n");
+
+	return (pos < n) ? pos : 0;
+}
+
+/*
+ * etag_listed - Returns whether the ETag of a stored response is in the
+ *		list of entity tags of an If-None-Match header, or the list is
+ *		"*". Tags are compared weakly, i.e. ignoring any W/ prefix.
+ */
+static int etag_listed(http_resp_t *resp, char *list)
+{
+	char *etag, *end;
+	size_t elen;
+
+	while (isblank(*list))
+		list++;
+	if (*list == '*')
+		return 1;
+	if (!resp->etag)
+		return 0;
+
+	etag = resp->etag;
+	elen = resp->etag_len;
+	if (elen > 2 && !strncmp(etag, "W/", 2)) {
+		etag += 2;
+		elen -= 2;
+	}
+
+	while (*list)
+	{
+		/* Skip separators and the weakness indicator */
+		while (*list == ',' || isblank(*list))
+			list++;
+		if (!strncmp(list, "W/", 2))
+			list += 2;
+		if (*list != '"' || !(end = strchr(list + 1, '"')))
+			return 0;
+		if ((size_t)(end + 1 - list) == elen && !strncmp(list, etag, elen))
+			return 1;
+		list = end + 1;
+	}
+
+	return 0;
+}
+
+/******************************/
+/*** END RESPONSE FUNCTIONS ***/
+/******************************/
+
+
+/***********************/
+/*** RANGE FUNCTIONS ***/
+/***********************/
+
+/*
+ * http_partial - build the reply to a Range request (range, and if_range
+ *		if not empty: the values of its Range and If-Range headers) from
+ *		a stored response of size bytes, the first len of which are at
+ *		obj, into p.
+ *		Returns 0 on success; -1 if the whole response should be sent
+ *		instead.
+ */
+int http_partial(http_partial_t *p, char *range, char *if_range, char *obj,
+				 size_t len, size_t size)
+{
+	http_resp_t resp;
+	char *buf, *end, *name, *value, *ctype = NULL;
+	char boundary[32], part[MAXLINE];
+	size_t i, nlen, vlen, body, total = 0, ctype_len = 0, pos = 0;
+	int n = 0, multi;
+
+	if (http_parse_response(obj, len, &resp) < 0 || resp.status != 200 ||
+		!if_range_holds(&resp, if_range))
+		return -1;
+	body = size - resp.head_len;
+	if ((p->n = parse_ranges(range, body, p->off, p->len)) < 0)
+		return -1;
+
+	/* Bodies with a transfer coding cannot be sliced as they are */
+	end = obj + resp.head_len;
+	buf = memchr(obj, '\n', end - obj) + 1;
+	while ((buf = next_header(buf, end, &name, &nlen, &value, &vlen)))
+	{
+		if (nlen == 17 && !strncasecmp(name, "Transfer-Encoding", 17))
+			return -1;
+		if (nlen == 12 && !strncasecmp(name, "Content-Type", 12)) {
+			ctype = value;
+			ctype_len = vlen;
+		}
+	}
+
+	/* None of the ranges overlaps the body */
+	if (!p->n) {
+		p->text[0] = p->buf;
+		p->text_len[0] = snprintf(p->buf, PARTIAL_TEXT,
+								  "HTTP/1.0 416 Range Not Satisfiable\r\n"
+								  "Content-Range: bytes */%zu\r\n"
+								  "Content-Length: 0\r\n\r\n", body);
+		return 0;
+	}
+
+	/* Several ranges go in the parts of a multipart body: the heads of
+	 * all parts but the first, and the closing boundary, come first
+	 */
+	multi = (p->n > 1);
+	snprintf(boundary, sizeof(boundary), "%08x",
+			 __atomic_add_fetch(&boundary_seq, 1, __ATOMIC_RELAXED));
+	for (i = 1; i <= (size_t)p->n; i++)
+	{
+		p->text[i] = p->buf + pos;
+		if (multi && i < (size_t)p->n &&
+			(partial_printf(p, &pos, "\r\n--%s\r\n", boundary) < 0 ||
+			 (ctype && partial_printf(p, &pos, "Content-Type: %.*s\r\n",
+									  (int)ctype_len, ctype) < 0) ||
+			 partial_printf(p, &pos, "Content-Range: bytes %zu-%zu/%zu\r\n\r\n",
+							p->off[i], p->off[i] + p->len[i] - 1, body) < 0))
+			return -1;
+		if (multi && i == (size_t)p->n &&
+			partial_printf(p, &pos, "\r\n--%s--\r\n", boundary) < 0)
+			return -1;
+		p->text_len[i] = p->buf + pos - p->text[i];
+		total += p->text_len[i];
+	}
+	part[0] = '\0';
+	if (multi && (n = snprintf(part, MAXLINE, "--%s\r\n%s%.*s%s"
+							   "Content-Range: bytes %zu-%zu/%zu\r\n\r\n",
+							   boundary, ctype ? "Content-Type: " : "",
+							   (int)ctype_len, ctype ? ctype : "",
+							   ctype ? "\r\n" : "", p->off[0],
+							   p->off[0] + p->len[0] - 1, body)) >= MAXLINE)
+		return -1;
+	total += multi ? n : 0;
+	for (i = 0; i < (size_t)p->n; i++)
+		total += p->len[i];
+
+	/* Then the head: the stored one, with a 206 status and its own
+	 * framing headers, followed by the head of the first part
+	 */
+	p->text[0] = p->buf + pos;
+	if (partial_printf(p, &pos, "%.*s 206 Partial Content\r\n",
+					   (int)((char *)memchr(obj, ' ', end - obj) - obj),
+					   obj) < 0)
+		return -1;
+	buf = memchr(obj, '\n', end - obj) + 1;
+	while ((buf = next_header(buf, end, &name, &nlen, &value, &vlen)))
+	{
+		if ((nlen == 14 && !strncasecmp(name, "Content-Length", 14)) ||
+			(nlen == 13 && !strncasecmp(name, "Content-Range", 13)) ||
+			(multi && nlen == 12 && !strncasecmp(name, "Content-Type", 12)))
+			continue;
+		if (partial_printf(p, &pos, "%.*s: %.*s\r\n",
+						   (int)nlen, name, (int)vlen, value) < 0)
+			return -1;
+	}
+	if ((multi ?
+		 partial_printf(p, &pos, "Content-Type: multipart/byteranges; "
+						"boundary=%s\r\n", boundary) :
+		 partial_printf(p, &pos, "Content-Range: bytes %zu-%zu/%zu\r\n",
+						p->off[0], p->off[0] + p->len[0] - 1, body)) < 0 ||
+		partial_printf(p, &pos, "Content-Length: %zu\r\n\r\n%s",
+					   total, part) < 0)
+		return -1;
+	p->text_len[0] = p->buf + pos - p->text[0];
+
+	/* Ranges were worked out on the body, which follows the head */
+	for (i = 0; i < (size_t)p->n; i++)
+		p->off[i] += resp.head_len;
+
+	return 0;
+}
+
+/*
+ * parse_ranges - parse the value s of a Range header over a body of
+ *		body bytes into the offsets and lengths of the ranges it asks
+ *		for. Ranges past the end of the body are left out.
+ *		Returns the number of ranges; -1 if s is not a valid byte range
+ *		set, or asks for more than MAX_RANGES.
+ */
+static int parse_ranges(char *s, size_t body, size_t *off, size_t *len)
+{
+	unsigned long long first, last;
+	int n = 0, overlaps;
+
+	if (strncasecmp(s, "bytes=", 6))
+		return -1;
+
+	/* first-last, first- (to the end), or -suffix (the last bytes),
+	 * separated by commas
+	 */
+	for (s += 6; ; s++)
+	{
+		while (isblank(*s))
+			s++;
+		if (*s == '-' && isdigit(s[1])) {
+			last = strtoull(s + 1, &s, 10);
+			first = (last < body) ? body - last : 0;
+			overlaps = (last > 0 && body > 0);
+			last = body - 1;
+		}
+		else if (isdigit(*s)) {
+			first = strtoull(s, &s, 10);
+			if (*s++ != '-')
+				return -1;
+			last = isdigit(*s) ? strtoull(s, &s, 10) : ULLONG_MAX;
+			if (last < first)
+				return -1;
+			if (last >= body)
+				last = body - 1;
+			overlaps = (first < body);
+		}
+		else
+			return -1;
+
+		if (overlaps) {
+			if (n == MAX_RANGES)
+				return -1;
+			off[n] = first;
+			len[n++] = last - first + 1;
+		}
+
+		while (isblank(*s))
+			s++;
+		if (!*s)
+			return n;
+		if (*s != ',')
+			return -1;
+	}
+}
+
+/*
+ * if_range_holds - Returns whether the If-Range condition of a request
+ *		(if_range, its value, empty if none) holds for a stored response:
+ *		the entity tag given must be its ETag, strongly compared, and the
+ *		date given its exact Last-Modified
+ */
+static int if_range_holds(http_resp_t *resp, char *if_range)
+{
+	size_t n = strlen(if_range);
+
+	if (!n)
+		return 1;
+	if (*if_range == '"')
+		return resp->etag && resp->etag_len == n &&
+			   !memcmp(resp->etag, if_range, n);
+
+	return resp->lastmod && resp->lastmod_len == n &&
+		   !memcmp(resp->lastmod, if_range, n);
+}
+
+/*
+ * partial_printf - append formatted text to the text of a reply to a
+ *		Range request, at *pos in its buffer.
+ *		Returns 0 on success, -1 if it does not fit.
+ */
+static int partial_printf(http_partial_t *p, size_t *pos, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(p->buf + *pos, PARTIAL_TEXT - *pos, fmt, ap);
+	va_end(ap);
+
+	if (n < 0 || (size_t)n >= PARTIAL_TEXT - *pos)
+		return -1;
+	*pos += n;
+	return 0;
+}
+
+/***************************/
+/*** END RANGE FUNCTIONS ***/
+/***************************/
+
+
+/************************/
+/*** HEADER FUNCTIONS ***/
+/************************/
+
+/*
+ * http_parse_date - parse the n-byte HTTP-date s (IMF-fixdate, or the
+ *		obsolete RFC 850 and asctime forms) into *t.
+ *		Returns 0 on success, -1 if it is not a valid date.
+ */
+int http_parse_date(char *s, size_t n, time_t *t)
+{
+	static const char *formats[] = {
+		"%a, %d %b %Y %H:%M:%S GMT",
+		"%A, %d-%b-%y %H:%M:%S GMT",
+		"%a %b %e %H:%M:%S %Y",
+		NULL
+	};
+	char buf[64];
+	struct tm tm;
+	char *rest;
+	int i;
+
+	if (n >= sizeof(buf))
+		return -1;
+	memcpy(buf, s, n);
+	buf[n] = '\0';
+
+	for (i = 0; formats[i]; i++)
+	{
+		memset(&tm, 0, sizeof(tm));
+		if ((rest = strptime(buf, formats[i], &tm)) && !*rest) {
+			*t = timegm(&tm);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * next_header - find the header line starting at buf, before end, and
+ *		point name and value (trimmed, with their lengths) into it.
+ *		Returns the start of the next line, or NULL at the end of the head
+ */
+static char *next_header(char *buf, char *end, char **name, size_t *nlen,
+						 char **value, size_t *vlen)
+{
+	char *eol, *colon;
+
+	while (buf < end && *buf != '\r' && *buf != '\n')
+	{
+		eol = memchr(buf, '\n', end - buf);
+		eol = eol ? eol : end;
+
+		/* Skip lines that are not headers */
+		if (!(colon = memchr(buf, ':', eol - buf))) {
+			buf = eol + 1;
+			continue;
+		}
+
+		*name = buf;
+		*nlen = colon - buf;
+		for (*value = colon + 1; *value < eol && isblank(**value); (*value)++)
+			;
+		for (*vlen = eol - *value; *vlen && isspace((*value)[*vlen - 1]);
+			 (*vlen)--)
+			;
+		return eol + 1;
+	}
+
+	return NULL;
+}
+
+/*
+ * header_listed - Returns whether a header name (nlen bytes) is in a
+ *		NULL-terminated list of names, ignoring case
+ */
+static int header_listed(const char **list, char *name, size_t nlen)
+{
+	for (; *list; list++)
+		if (strlen(*list) == nlen && !strncasecmp(name, *list, nlen))
+			return 1;
+	return 0;
+}
+
+/*
+ * carries_header - Returns whether the head from its first line (buf)
+ *		to end has a header named name (nlen bytes), ignoring case
+ */
+static int carries_header(char *buf, char *end, char *name, size_t nlen)
+{
+	char *hname, *value;
+	size_t hnlen, vlen;
+
+	buf = memchr(buf, '\n', end - buf) + 1;
+	while ((buf = next_header(buf, end, &hname, &hnlen, &value, &vlen)))
+		if (hnlen == nlen && !strncasecmp(hname, name, nlen))
+			return 1;
+	return 0;
+}
+
+/*
+ * parse_cache_control - add the directives of an n-byte Cache-Control
+ *		header value to resp
+ */
+static void parse_cache_control(char *s, size_t n, http_resp_t *resp)
+{
+	char *end = s + n, *dir, *eq;
+	size_t len;
+
+	while (s < end)
+	{
+		/* Next comma-separated directive, trimmed */
+		for (; s < end && (*s == ',' || isblank(*s)); s++)
+			;
+		for (dir = s; s < end && *s != ','; s++)
+			if (*s == '"')
+				while (++s < end && *s != '"')
+					;
+		for (len = s - dir; len && isblank(dir[len - 1]); len--)
+			;
+		if (!len)
+			continue;
+
+		/* Directive names stop at their argument, if any */
+		eq = memchr(dir, '=', len);
+		n = eq ? (size_t)(eq - dir) : len;
+
+		if (n == 8 && !strncasecmp(dir, "no-store", 8))
+			resp->cc |= CC_NO_STORE;
+		else if (n == 8 && !strncasecmp(dir, "no-cache", 8))
+			resp->cc |= CC_NO_CACHE;
+		else if (n == 7 && !strncasecmp(dir, "private", 7))
+			resp->cc |= CC_PRIVATE;
+		else if (n == 6 && !strncasecmp(dir, "public", 6))
+			resp->cc |= CC_PUBLIC;
+		else if (n == 15 && !strncasecmp(dir, "must-revalidate", 15))
+			resp->cc |= CC_MUST_REVALIDATE;
+		else if (n == 16 && !strncasecmp(dir, "proxy-revalidate", 16))
+			resp->cc |= CC_MUST_REVALIDATE;
+		else if (n == 7 && eq && !strncasecmp(dir, "max-age", 7))
+			resp->max_age = parse_seconds(eq + 1, dir + len - eq - 1);
+		else if (n == 8 && eq && !strncasecmp(dir, "s-maxage", 8))
+			resp->s_maxage = parse_seconds(eq + 1, dir + len - eq - 1);
+		else if (n == 22 && eq &&
+				 !strncasecmp(dir, "stale-while-revalidate", 22))
+			resp->swr = parse_seconds(eq + 1, dir + len - eq - 1);
+	}
+}
+
+/*
+ * parse_vary - add the request header names of an n-byte Vary header
+ *		value to resp->vary, lowercased and once each. "*", or more names
+ *		than fit, make the response vary on everything (vary_all).
+ */
+static void parse_vary(char *s, size_t n, http_resp_t *resp)
+{
+	char *end = s + n, *name, *p, *q;
+	size_t len, pos = strlen(resp->vary);
+
+	while (s < end)
+	{
+		/* Next comma-separated name, trimmed */
+		for (; s < end && (*s == ',' || isblank(*s)); s++)
+			;
+		for (name = s; s < end && *s != ','; s++)
+			;
+		for (len = s - name; len && isblank(name[len - 1]); len--)
+			;
+		if (!len)
+			continue;
+		if (len == 1 && *name == '*') {
+			resp->vary_all = 1;
+			return;
+		}
+
+		/* Skip names listed already */
+		for (p = resp->vary; *p; p = q + (*q == ','))
+		{
+			if (!(q = strchr(p, ',')))
+				q = p + strlen(p);
+			if ((size_t)(q - p) == len && !strncasecmp(p, name, len))
+				break;
+		}
+		if (*p)
+			continue;
+
+		if (pos + (pos > 0) + len >= MAX_VARY) {
+			resp->vary_all = 1;
+			return;
+		}
+		if (pos)
+			resp->vary[pos++] = ',';
+		for (; len; len--)
+			resp->vary[pos++] = tolower(*name++);
+		resp->vary[pos] = '\0';
+	}
+}
+
+/*
+ * has_credentials - Returns whether a request (its request line and
+ *		headers) carries an Authorization header
+ */
+static int has_credentials(char *req)
+{
+	char *buf, *end, *name, *value;
+	size_t nlen, vlen;
+
+	if (!(buf = strchr(req, '\n')))
+		return 0;
+	end = buf + strlen(buf);
+	for (buf++; (buf = next_header(buf, end, &name, &nlen, &value, &vlen)); )
+		if (nlen == 13 && !strncasecmp(name, "Authorization", 13))
+			return 1;
+
+	return 0;
+}
+
+/*
+ * parse_seconds - parse an n-byte delta-seconds value, possibly quoted.
+ *		Returns the value, 0 if it is not a number
+ */
+static long parse_seconds(char *s, size_t n)
+{
+	long secs = 0;
+
+	if (n >= 2 && s[0] == '"' && s[n - 1] == '"') {
+		s++;
+		n -= 2;
+	}
+	for (; n && isdigit(*s); s++, n--)
+	{
+		/* Values too large to hold saturate (RFC 9111 section 1.2.2) */
+		if (secs > (0x7fffffffL - 9) / 10)
+			return 0x7fffffffL;
+		secs = secs * 10 + (*s - '0');
+	}
+
+	return secs;
+}
+
+/****************************/
+/*** END HEADER FUNCTIONS ***/
+/****************************/
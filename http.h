@@ -0,0 +1,97 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * http.h
+ * CODE DESCRIPTION
+ *
+ * Header for http.c
+ */
+
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include <stddef.h>
+#include <time.h>
+
+/* Default freshness lifetime (seconds) of responses that give none */
+#define DEF_TTL 300
+
+/* Cap on the freshness lifetime guessed from Last-Modified */
+#define MAX_HEURISTIC_TTL (24 * 3600)
+
+/* Cache-Control directives of a response */
+#define CC_NO_STORE			0x01
+#define CC_NO_CACHE			0x02
+#define CC_PRIVATE			0x04
+#define CC_PUBLIC			0x08
+#define CC_MUST_REVALIDATE	0x10
+
+/* Longest list of request headers a cached response may vary on */
+#define MAX_VARY 128
+
+/* Most ranges a Range request is answered with; more get the whole
+ * response
+ */
+#define MAX_RANGES 16
+
+/* Room for the text of a reply to a Range request (heads, boundaries) */
+#define PARTIAL_TEXT 8192
+
+/* Parsed response head; times are -1 when the header is absent */
+typedef struct HttpResp {
+	int status;			// Status code
+	size_t head_len;	// Length of the status line and headers
+	time_t date;		// Date
+	time_t expires;		// Expires (0 if invalid, i.e. already expired)
+	time_t last_modified; // Last-Modified
+	long age;			// Age, 0 if absent
+	long max_age;		// Cache-Control max-age, -1 if absent
+	long s_maxage;		// Cache-Control s-maxage, -1 if absent
+	long swr;			// Cache-Control stale-while-revalidate, -1 if absent
+	unsigned cc;		// Other Cache-Control directives (CC_*)
+	int vary_all;		// Whether Vary is "*" (or too long to keep)
+	char vary[MAX_VARY]; // Request headers it varies on, lowercased and
+						 // comma-separated ("" if none)
+	char *etag;			// ETag value, in the parsed head, or NULL
+	size_t etag_len;
+	char *lastmod;		// Last-Modified value, likewise
+	size_t lastmod_len;
+} http_resp_t;
+
+/* Reply to a Range request, sliced out of a stored response: the text
+ * before each range, then the range, and the text after the last one.
+ * A 416 reply is text[0] alone.
+ */
+typedef struct HttpPartial {
+	int n;							// Number of ranges
+	size_t off[MAX_RANGES];			// Offset of each in the response...
+	size_t len[MAX_RANGES];			// ... and its length
+	char *text[MAX_RANGES + 1];		// Text before each, and after the last
+	size_t text_len[MAX_RANGES + 1];
+	char buf[PARTIAL_TEXT];			// Holds the text
+} http_partial_t;
+
+/* Response functions */
+int http_parse_response(char *obj, size_t len, http_resp_t *resp);
+int http_freshness(http_resp_t *resp, char *req, time_t now,
+				   time_t default_ttl, time_t *expires);
+long http_stale_window(http_resp_t *resp, long default_swr);
+size_t http_merge(char *stored, size_t len, char *resp, size_t resp_len,
+				  char *out, size_t n);
+int http_conditional(http_resp_t *resp, char *hdrs, size_t n);
+size_t http_not_modified(char *obj, size_t len, char *inm, char *ims,
+						 char *out, size_t n);
+/* Range functions */
+int http_partial(http_partial_t *p, char *range, char *if_range, char *obj,
+				 size_t len, size_t size);
+/* Header functions */
+int http_parse_date(char *s, size_t n, time_t *t);
+
+#endif /* __HTTP_H__ */
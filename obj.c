@@ -0,0 +1,161 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * obj.c
+ * CODE DESCRIPTION
+ *
+ * Segmented storage of web objects. An object is a chain of fixed-size
+ * segments, filled in order as its bytes arrive, so it never has to be
+ * held in (or moved into) one contiguous buffer, whatever its size. A
+ * fill that goes past its limit frees what it has and stops there.
+ *
+ * Segments never move once taken, so a response can be read straight
+ * into the room at the end of its object (obj_room, obj_commit) and
+ * relayed from there, and the filled chain handed over to the cache as
+ * it is.
+ *
+ * Segments come from the slab allocator of the shard the object belongs
+ * to, one block of its largest size class each, so they fill their
+ * pages exactly and are recycled between objects of any size.
+ */
+
+#include <stdint.h>
+#include "csapp.h"
+#include "obj.h"
+
+
+/************************/
+/*** OBJECT FUNCTIONS ***/
+/************************/
+
+/*
+ * obj_append - append n bytes of data to an object, taking new segments
+ *		from slab as needed.
+ *		Returns 0 on success; -1 if the object would grow past limit
+ *		bytes, in which case it is freed.
+ */
+int obj_append(obj_t *obj, slab_t *slab, char *data, size_t n, size_t limit)
+{
+	size_t chunk;
+	char *room;
+
+	if (obj->len + n > limit) {
+		obj_free(obj, slab);
+		return -1;
+	}
+
+	while (n > 0)
+	{
+		room = obj_room(obj, slab, SIZE_MAX, &chunk);
+		if (chunk > n)
+			chunk = n;
+		memcpy(room, data, chunk);
+		obj_commit(obj, chunk);
+		data += chunk;
+		n -= chunk;
+	}
+
+	return 0;
+}
+
+/*
+ * obj_room - get room at the end of an object for up to limit bytes in
+ *		all, to fill in place (then obj_commit), taking a new segment
+ *		from slab if the last one is full. Sets *room to its size.
+ *		Returns where the room starts, NULL if the object is already
+ *		limit bytes long.
+ */
+char *obj_room(obj_t *obj, slab_t *slab, size_t limit, size_t *room)
+{
+	obj_seg_t *seg;
+
+	if (obj->len >= limit)
+		return NULL;
+
+	if (!obj->tl || obj->tl->len == obj->tl->cap)
+	{
+		seg = (obj_seg_t *)slab_alloc(slab, slab->max_block);
+		seg->next = NULL;
+		seg->len = 0;
+		seg->cap = obj_seg_cap(slab);
+		if (obj->tl)
+			obj->tl->next = seg;
+		else
+			obj->hd = seg;
+		obj->tl = seg;
+	}
+
+	*room = obj->tl->cap - obj->tl->len;
+	if (*room > limit - obj->len)
+		*room = limit - obj->len;
+	return obj->tl->data + obj->tl->len;
+}
+
+/*
+ * obj_commit - add n bytes just filled in the room given by obj_room
+ *		to the object
+ */
+void obj_commit(obj_t *obj, size_t n)
+{
+	obj->tl->len += n;
+	obj->len += n;
+}
+
+/*
+ * obj_trim - free the last segment of an object if nothing was filled
+ *		in it, as when the room asked for last met the end of the
+ *		response
+ */
+void obj_trim(obj_t *obj, slab_t *slab)
+{
+	obj_seg_t *seg;
+
+	if (!obj->tl || obj->tl->len)
+		return;
+
+	if (obj->hd == obj->tl)
+		obj->hd = NULL;
+	else {
+		for (seg = obj->hd; seg->next != obj->tl; seg = seg->next)
+			;
+		seg->next = NULL;
+	}
+	slab_free(slab, obj->tl, sizeof(obj_seg_t) + obj->tl->cap);
+	obj->tl = (obj->hd) ? seg : NULL;
+}
+
+/*
+ * obj_free - free every segment of an object taken from slab, leaving
+ *		it empty
+ */
+void obj_free(obj_t *obj, slab_t *slab)
+{
+	obj_seg_t *seg;
+
+	while ((seg = obj->hd))
+	{
+		obj->hd = seg->next;
+		slab_free(slab, seg, sizeof(obj_seg_t) + seg->cap);
+	}
+	obj->tl = NULL;
+	obj->len = 0;
+}
+
+/*
+ * obj_seg_cap - Returns the room in each segment taken from slab
+ */
+size_t obj_seg_cap(slab_t *slab)
+{
+	return slab->max_block - sizeof(obj_seg_t);
+}
+
+/****************************/
+/*** END OBJECT FUNCTIONS ***/
+/****************************/
@@ -0,0 +1,46 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * obj.h
+ * CODE DESCRIPTION
+ *
+ * Header for obj.c
+ */
+
+#ifndef __OBJ_H__
+#define __OBJ_H__
+
+#include <stddef.h>
+#include "slab.h"
+
+/* Segment of a web object; filled in order and never moved */
+typedef struct ObjSeg {
+	struct ObjSeg *next;
+	size_t len;			// Bytes filled in
+	size_t cap;			// Room in data
+	char data[];
+} obj_seg_t;
+
+/* Web object: a chain of segments, each full but the last */
+typedef struct Obj {
+	obj_seg_t *hd;		// First segment, NULL if empty
+	obj_seg_t *tl;		// Segment being filled
+	size_t len;			// Size of the object
+} obj_t;
+
+/* Object functions */
+int obj_append(obj_t *obj, slab_t *slab, char *data, size_t n, size_t limit);
+char *obj_room(obj_t *obj, slab_t *slab, size_t limit, size_t *room);
+void obj_commit(obj_t *obj, size_t n);
+void obj_trim(obj_t *obj, slab_t *slab);
+void obj_free(obj_t *obj, slab_t *slab);
+size_t obj_seg_cap(slab_t *slab);
+
+#endif /* __OBJ_H__ */
@@ -0,0 +1,610 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * policy.c
+ * CODE DESCRIPTION
+ *
+ * Eviction policies of the web cache, picked at start-up by name:
+ *
+ * lru    - LRU with lazy promotion: hit lines found at the back of the
+ *          recency list are moved to the front instead of being evicted.
+ * s3fifo - S3-FIFO: new lines enter a small FIFO (10% of the shard); those
+ *          hit while there move on to the main FIFO, the others are
+ *          evicted and remembered in a ghost list, and keys found in the
+ *          ghost list go straight to the main FIFO. Main lines are
+ *          reinserted while their (2-bit) frequency lasts. Scan-resistant.
+ * arc    - ARC, in its CAR (Clock with Adaptive Replacement) form, which
+ *          only needs a referenced bit per line: a recency clock T1 and a
+ *          frequency clock T2, with ghost lists B1 and B2 steering the
+ *          target size of T1. Sizes are counted in bytes.
+ * gdsf   - GreedyDual-Size-Frequency: lines are kept in a min-heap on
+ *          H = L + freq / size, where L is the H of the last victim, so
+ *          small and popular objects outlive large and cold ones.
+ *
+ * Hits run under the shard's read lock, so they only bump line->freq and
+ * policies act on it when picking a victim: LRU and CAR read it as a
+ * referenced bit, S3-FIFO as a small counter, and GDSF recomputes the
+ * H of a stale heap top before evicting it (lazy re-evaluation).
+ */
+
+#include "csapp.h"
+#include "webcache.h"
+
+static void list_remove(shard_t *shard, line_t *line);
+static line_t* lru_victim(shard_t *shard);
+static void lru_insert(shard_t *shard, line_t *line);
+static void s3fifo_init(shard_t *shard);
+static void s3fifo_deinit(shard_t *shard);
+static void s3fifo_insert(shard_t *shard, line_t *line);
+static line_t* s3fifo_victim(shard_t *shard);
+static void s3fifo_evicted(shard_t *shard, line_t *line);
+static void arc_init(shard_t *shard);
+static void arc_deinit(shard_t *shard);
+static void arc_insert(shard_t *shard, line_t *line);
+static line_t* arc_victim(shard_t *shard);
+static void arc_evicted(shard_t *shard, line_t *line);
+static void gdsf_init(shard_t *shard);
+static void gdsf_deinit(shard_t *shard);
+static void gdsf_insert(shard_t *shard, line_t *line);
+static void gdsf_remove(shard_t *shard, line_t *line);
+static line_t* gdsf_victim(shard_t *shard);
+static void gdsf_evicted(shard_t *shard, line_t *line);
+static void heap_swap(shard_t *shard, size_t i, size_t j);
+static void heap_up(shard_t *shard, size_t i);
+static void heap_down(shard_t *shard, size_t i);
+static size_t *ghost_slot(ghost_t *ghost, uint64_t hash);
+static void ghost_delete(ghost_t *ghost, size_t *slot);
+
+/* Available policies */
+static const policy_t policies[] = {
+	{ "lru", 1, NULL, NULL, lru_insert, list_remove, lru_victim, NULL },
+	{ "s3fifo", 3, s3fifo_init, s3fifo_deinit,
+	  s3fifo_insert, list_remove, s3fifo_victim, s3fifo_evicted },
+	{ "arc", 1, arc_init, arc_deinit,
+	  arc_insert, list_remove, arc_victim, arc_evicted },
+	{ "gdsf", 255, gdsf_init, gdsf_deinit,
+	  gdsf_insert, gdsf_remove, gdsf_victim, gdsf_evicted },
+	{ NULL }
+};
+
+
+/************************/
+/*** POLICY FUNCTIONS ***/
+/************************/
+
+/*
+ * policy_find - return the policy with the given name, NULL if none
+ */
+const policy_t* policy_find(char *name)
+{
+	const policy_t *policy;
+
+	for (policy = policies; policy->name; policy++)
+		if (!strcmp(policy->name, name))
+			return policy;
+
+	return NULL;
+}
+
+/*
+ * list_remove - take a line out of whichever queue holds it
+ */
+static void list_remove(shard_t *shard, line_t *line)
+{
+	unlink_line(line);
+}
+
+/****************************/
+/*** END POLICY FUNCTIONS ***/
+/****************************/
+
+
+/*********************/
+/*** LRU FUNCTIONS ***/
+/*********************/
+
+/*
+ * lru_insert - add a new line at the front of the recency list
+ */
+static void lru_insert(shard_t *shard, line_t *line)
+{
+	link_line(&shard->queues[0], line);
+}
+
+/*
+ * lru_victim - Returns the least recently used line in the shard, which
+ * 		is the one at the back of the recency list once lines hit since
+ *		they were last there have been moved to the front.
+ */
+static line_t* lru_victim(shard_t *shard)
+{
+	line_t *line;
+	queue_t *q = &shard->queues[0];
+
+	/* Each line moves at most once, as its bit is cleared on the way */
+	while ((line = q->tl)->freq && q->hd != line)
+	{
+		line->freq = 0;
+		touch_line(line);
+	}
+
+	return line;
+}
+
+/*************************/
+/*** END LRU FUNCTIONS ***/
+/*************************/
+
+
+/*************************/
+/*** S3-FIFO FUNCTIONS ***/
+/*************************/
+
+/*
+ * s3fifo_init - set up the ghost list of keys evicted from the small FIFO
+ */
+static void s3fifo_init(shard_t *shard)
+{
+	ghost_init(&shard->ghosts[0], shard->max_size);
+}
+
+/*
+ * s3fifo_deinit - free the ghost list
+ */
+static void s3fifo_deinit(shard_t *shard)
+{
+	ghost_deinit(&shard->ghosts[0]);
+}
+
+/*
+ * s3fifo_insert - add a new line to the small FIFO (queues[0]), or to the
+ *		main FIFO (queues[1]) if its key was evicted recently
+ */
+static void s3fifo_insert(shard_t *shard, line_t *line)
+{
+	if (ghost_remove(&shard->ghosts[0], line->hash))
+		link_line(&shard->queues[1], line);
+	else
+		link_line(&shard->queues[0], line);
+}
+
+/*
+ * s3fifo_victim - pick the line to evict. The small FIFO is drained while
+ *		it holds more than a tenth of the shard; its lines hit since
+ *		insertion move to the main FIFO instead. Main FIFO lines are
+ *		reinserted, one frequency point at a time, until one runs out.
+ */
+static line_t* s3fifo_victim(shard_t *shard)
+{
+	line_t *line;
+	queue_t *small = &shard->queues[0], *mainq = &shard->queues[1];
+
+	while (1)
+	{
+		if (small->hd && (small->size > shard->max_size / 10 || !mainq->hd))
+		{
+			line = small->tl;
+			if (!line->freq)
+				return line;
+			line->freq = 0;
+			unlink_line(line);
+			link_line(mainq, line);
+		}
+		else
+		{
+			line = mainq->tl;
+			if (!line->freq)
+				return line;
+			line->freq--;
+			touch_line(line);
+		}
+	}
+}
+
+/*
+ * s3fifo_evicted - remember the keys of lines evicted from the small FIFO
+ */
+static void s3fifo_evicted(shard_t *shard, line_t *line)
+{
+	if (line->queue == &shard->queues[0])
+		ghost_add(&shard->ghosts[0], line->hash, line->size);
+}
+
+/*****************************/
+/*** END S3-FIFO FUNCTIONS ***/
+/*****************************/
+
+
+/*********************/
+/*** ARC FUNCTIONS ***/
+/*********************/
+
+/*
+ * arc_init - set up the ghost lists B1 (ghosts[0]) and B2 (ghosts[1]),
+ *		starting with no preference between recency and frequency
+ */
+static void arc_init(shard_t *shard)
+{
+	ghost_init(&shard->ghosts[0], shard->max_size);
+	ghost_init(&shard->ghosts[1], shard->max_size);
+	shard->target = 0;
+}
+
+/*
+ * arc_deinit - free the ghost lists
+ */
+static void arc_deinit(shard_t *shard)
+{
+	ghost_deinit(&shard->ghosts[0]);
+	ghost_deinit(&shard->ghosts[1]);
+}
+
+/*
+ * arc_insert - add a new line to T1 (queues[0]), or to T2 (queues[1])
+ *		if its key is in a ghost list, in which case the target size of
+ *		T1 grows (hit in B1) or shrinks (hit in B2)
+ */
+static void arc_insert(shard_t *shard, line_t *line)
+{
+	size_t delta;
+	ghost_t *b1 = &shard->ghosts[0], *b2 = &shard->ghosts[1];
+
+	if (b1->bytes && ghost_remove(b1, line->hash))
+	{
+		delta = line->size *
+				(b2->bytes > b1->bytes ? b2->bytes / (b1->bytes + 1) : 1);
+		shard->target = (shard->target + delta < shard->max_size) ?
+						shard->target + delta : shard->max_size;
+		link_line(&shard->queues[1], line);
+	}
+	else if (b2->bytes && ghost_remove(b2, line->hash))
+	{
+		delta = line->size *
+				(b1->bytes > b2->bytes ? b1->bytes / (b2->bytes + 1) : 1);
+		shard->target = (shard->target > delta) ? shard->target - delta : 0;
+		link_line(&shard->queues[1], line);
+	}
+	else
+	{
+		/* Keep T1 + B1 within the shard budget, and the whole directory
+		 * within twice the budget
+		 */
+		while (b1->bytes && shard->queues[0].size + b1->bytes + line->size >
+			   shard->max_size)
+			ghost_pop(b1);
+		while (b2->bytes && shard->size + b1->bytes + b2->bytes >
+			   2 * shard->max_size)
+			ghost_pop(b2);
+		link_line(&shard->queues[0], line);
+	}
+}
+
+/*
+ * arc_victim - pick the line to evict, sweeping the T1 clock while T1 is
+ *		over its target size and the T2 clock otherwise. Referenced lines
+ *		are spared, T1's moving on to T2.
+ */
+static line_t* arc_victim(shard_t *shard)
+{
+	line_t *line;
+	queue_t *t1 = &shard->queues[0], *t2 = &shard->queues[1];
+
+	while (1)
+	{
+		if (t1->hd && (t1->size >= shard->target || !t2->hd))
+		{
+			line = t1->tl;
+			if (!line->freq)
+				return line;
+			line->freq = 0;
+			unlink_line(line);
+			link_line(t2, line);
+		}
+		else
+		{
+			line = t2->tl;
+			if (!line->freq)
+				return line;
+			line->freq = 0;
+			touch_line(line);
+		}
+	}
+}
+
+/*
+ * arc_evicted - remember the key of an evicted line in B1 if it came
+ *		from T1, in B2 if it came from T2
+ */
+static void arc_evicted(shard_t *shard, line_t *line)
+{
+	int t = (line->queue == &shard->queues[1]);
+
+	ghost_add(&shard->ghosts[t], line->hash, line->size);
+}
+
+/*************************/
+/*** END ARC FUNCTIONS ***/
+/*************************/
+
+
+/**********************/
+/*** GDSF FUNCTIONS ***/
+/**********************/
+
+/*
+ * gdsf_prio - the GDSF priority of a line, given the current inflation L
+ */
+static double gdsf_prio(shard_t *shard, line_t *line, unsigned freq)
+{
+	return shard->clock + (double)(freq + 1) / (double)(line->size + 1);
+}
+
+/*
+ * gdsf_init - set up an empty heap
+ */
+static void gdsf_init(shard_t *shard)
+{
+	shard->clock = 0;
+	shard->heap_len = 0;
+	shard->heap_cap = INDEX_INIT_SLOTS;
+	shard->heap = (line_t **)Calloc(shard->heap_cap, sizeof(line_t *));
+}
+
+/*
+ * gdsf_deinit - free the heap
+ */
+static void gdsf_deinit(shard_t *shard)
+{
+	Free(shard->heap);
+}
+
+/*
+ * gdsf_insert - add a new line to the heap
+ */
+static void gdsf_insert(shard_t *shard, line_t *line)
+{
+	if (shard->heap_len == shard->heap_cap) {
+		shard->heap_cap *= 2;
+		shard->heap = (line_t **)Realloc(shard->heap,
+										 shard->heap_cap * sizeof(line_t *));
+	}
+
+	line->prio_freq = line->freq;
+	line->prio = gdsf_prio(shard, line, line->freq);
+	line->heap_idx = shard->heap_len;
+	shard->heap[shard->heap_len++] = line;
+	heap_up(shard, line->heap_idx);
+}
+
+/*
+ * gdsf_remove - take a line out of the heap
+ */
+static void gdsf_remove(shard_t *shard, line_t *line)
+{
+	size_t i = line->heap_idx;
+
+	if (i != --shard->heap_len) {
+		heap_swap(shard, i, shard->heap_len);
+		heap_down(shard, i);
+		heap_up(shard, i);
+	}
+}
+
+/*
+ * gdsf_victim - pick the line with the lowest priority. A line hit since
+ *		its priority was last computed gets it recomputed and goes back
+ *		into the heap instead.
+ */
+static line_t* gdsf_victim(shard_t *shard)
+{
+	line_t *line = shard->heap[0];
+
+	while (line->freq != line->prio_freq)
+	{
+		line->prio_freq = line->freq;
+		line->prio = gdsf_prio(shard, line, line->freq);
+		heap_down(shard, 0);
+		line = shard->heap[0];
+	}
+
+	return line;
+}
+
+/*
+ * gdsf_evicted - age the cache: the victim's priority becomes the new L
+ */
+static void gdsf_evicted(shard_t *shard, line_t *line)
+{
+	shard->clock = line->prio;
+}
+
+/*
+ * heap_swap - swap two heap entries, keeping their heap_idx up to date
+ */
+static void heap_swap(shard_t *shard, size_t i, size_t j)
+{
+	line_t *tmp = shard->heap[i];
+
+	shard->heap[i] = shard->heap[j];
+	shard->heap[j] = tmp;
+	shard->heap[i]->heap_idx = i;
+	shard->heap[j]->heap_idx = j;
+}
+
+/*
+ * heap_up - move heap entry i up to its place
+ */
+static void heap_up(shard_t *shard, size_t i)
+{
+	while (i && shard->heap[i]->prio < shard->heap[(i - 1) / 2]->prio)
+	{
+		heap_swap(shard, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+/*
+ * heap_down - move heap entry i down to its place
+ */
+static void heap_down(shard_t *shard, size_t i)
+{
+	size_t min, child;
+
+	while (1)
+	{
+		min = i;
+		for (child = 2 * i + 1; child <= 2 * i + 2; child++)
+			if (child < shard->heap_len &&
+				shard->heap[child]->prio < shard->heap[min]->prio)
+				min = child;
+		if (min == i)
+			return;
+		heap_swap(shard, i, min);
+		i = min;
+	}
+}
+
+/**************************/
+/*** END GDSF FUNCTIONS ***/
+/**************************/
+
+
+/***********************/
+/*** GHOST FUNCTIONS ***/
+/***********************/
+
+/*
+ * ghost_init - set up an empty ghost list remembering up to max_bytes
+ *		worth of evicted lines
+ */
+void ghost_init(ghost_t *ghost, size_t max_bytes)
+{
+	ghost->slots = GHOST_MIN_SLOTS;
+	while (ghost->slots < max_bytes / GHOST_UNIT)
+		ghost->slots *= 2;
+	ghost->ring = (ghost_entry_t *)Calloc(ghost->slots, sizeof(ghost_entry_t));
+	ghost->table = (size_t *)Calloc(2 * ghost->slots, sizeof(size_t));
+	ghost->head = ghost->tail = 0;
+	ghost->bytes = 0;
+	ghost->max_bytes = max_bytes;
+}
+
+/*
+ * ghost_deinit - free a ghost list
+ */
+void ghost_deinit(ghost_t *ghost)
+{
+	Free(ghost->ring);
+	Free(ghost->table);
+}
+
+/*
+ * ghost_add - remember an evicted line, forgetting the oldest ones
+ *		to make room
+ */
+void ghost_add(ghost_t *ghost, uint64_t hash, size_t size)
+{
+	ghost_entry_t *entry;
+
+	while (ghost->tail - ghost->head == ghost->slots ||
+		   (ghost->bytes && ghost->bytes + size > ghost->max_bytes))
+		ghost_pop(ghost);
+
+	/* A key is remembered once */
+	ghost_remove(ghost, hash);
+
+	entry = &ghost->ring[ghost->tail & (ghost->slots - 1)];
+	entry->hash = hash;
+	entry->size = size;
+	*ghost_slot(ghost, hash) = ++ghost->tail;
+	ghost->bytes += size;
+}
+
+/*
+ * ghost_remove - forget the line with the given hash.
+ *		Returns 1 if it was remembered, 0 otherwise
+ */
+int ghost_remove(ghost_t *ghost, uint64_t hash)
+{
+	size_t *slot = ghost_slot(ghost, hash);
+	ghost_entry_t *entry;
+
+	if (!*slot)
+		return 0;
+
+	entry = &ghost->ring[(*slot - 1) & (ghost->slots - 1)];
+	ghost->bytes -= entry->size;
+	ghost_delete(ghost, slot);
+	entry->hash = 0;
+	return 1;
+}
+
+/*
+ * ghost_pop - forget the oldest line, if any
+ */
+void ghost_pop(ghost_t *ghost)
+{
+	ghost_entry_t *entry;
+
+	/* Skip over entries that were removed already */
+	while (ghost->head != ghost->tail)
+	{
+		entry = &ghost->ring[ghost->head++ & (ghost->slots - 1)];
+		if (entry->hash) {
+			ghost_remove(ghost, entry->hash);
+			return;
+		}
+	}
+}
+
+/*
+ * ghost_slot - return the table slot holding the position of the entry
+ *		for hash, or the empty slot where it would go
+ */
+static size_t *ghost_slot(ghost_t *ghost, uint64_t hash)
+{
+	size_t mask = 2 * ghost->slots - 1;
+	size_t i;
+
+	for (i = hash & mask; ghost->table[i]; i = (i + 1) & mask)
+		if (ghost->ring[(ghost->table[i] - 1) & (ghost->slots - 1)].hash == hash)
+			break;
+
+	return &ghost->table[i];
+}
+
+/*
+ * ghost_delete - empty a table slot, shifting later entries of the same
+ *		probe run back as index_remove does
+ */
+static void ghost_delete(ghost_t *ghost, size_t *slot)
+{
+	size_t mask = 2 * ghost->slots - 1;
+	size_t i = slot - ghost->table;
+	size_t j, home;
+
+	for (j = (i + 1) & mask; ghost->table[j]; j = (j + 1) & mask)
+	{
+		home = ghost->ring[(ghost->table[j] - 1) &
+						   (ghost->slots - 1)].hash & mask;
+		if ((j > i && (home <= i || home > j)) ||
+			(j < i && (home <= i && home > j)))
+		{
+			ghost->table[i] = ghost->table[j];
+			i = j;
+		}
+	}
+
+	ghost->table[i] = 0;
+}
+
+/***************************/
+/*** END GHOST FUNCTIONS ***/
+/***************************/
@@ -0,0 +1,76 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * policy.h
+ * CODE DESCRIPTION
+ *
+ * Header for policy.c
+ */
+
+#ifndef __POLICY_H__
+#define __POLICY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct Shard; // Defined in webcache.h
+struct Line;
+
+/* Default eviction policy */
+#define DEF_POLICY "lru"
+
+/* Bytes of shard budget per ghost entry, and minimum ghost entries */
+#define GHOST_UNIT 4096
+#define GHOST_MIN_SLOTS 64
+
+/* Ghost entry: a recently evicted key, remembered by hash only */
+typedef struct GhostEntry {
+	uint64_t hash;	// Hash of the key, 0 once removed
+	size_t size;	// Size of the line it stood for
+} ghost_entry_t;
+
+/* Ghost list: FIFO of recently evicted keys, with a hash table on top */
+typedef struct Ghost {
+	ghost_entry_t *ring; // Entries, oldest at head
+	size_t head;	// Position of the oldest entry (counts up forever)
+	size_t tail;	// Position of the next entry (counts up forever)
+	size_t slots;	// Number of ring entries, a power of 2
+	size_t *table;	// Open-addressing table of positions+1, 2*slots long
+	size_t bytes;	// Total size of the live entries
+	size_t max_bytes; // Oldest entries are dropped beyond this
+} ghost_t;
+
+/* Eviction policy. Every hook runs with the shard's write lock held;
+ * hits only bump the line's freq, up to max_freq, under the read lock,
+ * and policies act on it lazily. victim only picks a line (it may
+ * reorder the queues on the way); evicted is called once the line is
+ * actually evicted, before it is removed.
+ */
+typedef struct Policy {
+	char *name;
+	unsigned max_freq;	// Saturation point of line->freq
+	void (*init)(struct Shard *shard);
+	void (*deinit)(struct Shard *shard);
+	void (*insert)(struct Shard *shard, struct Line *line);
+	void (*remove)(struct Shard *shard, struct Line *line);
+	struct Line* (*victim)(struct Shard *shard);
+	void (*evicted)(struct Shard *shard, struct Line *line);
+} policy_t;
+
+/* Policy functions */
+const policy_t* policy_find(char *name);
+/* Ghost functions */
+void ghost_init(ghost_t *ghost, size_t max_bytes);
+void ghost_deinit(ghost_t *ghost);
+void ghost_add(ghost_t *ghost, uint64_t hash, size_t size);
+int ghost_remove(ghost_t *ghost, uint64_t hash);
+void ghost_pop(ghost_t *ghost);
+
+#endif /* __POLICY_H__ */
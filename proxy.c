@@ -20,10 +20,36 @@
 #include <stdio.h>
 #include "csapp.h"
 #include "webcache.h"
+#include <sys/sendfile.h>
+#include "proxy.h"
+#include "reactor.h"
+#include "sbuf.h"
+#include "snapshot.h"
+#include "flight.h"
+#include "http.h"
 
 /* Network-compatible rio macros */
-#define RIOWRITEN(fd, buf, n)    {if (my_rio_writen(fd, buf, n) <= 0) return;}
-#define RIOREADLINEB(fd, buf, n) {if (my_rio_readlineb(fd, buf, n) < 0) return -1;}
+#define RIOWRITEN(fd, buf, n)    {if (my_rio_writen(fd, buf, n) < 0) return;}
+#define RIOREADLINEB(fd, buf, n) {if (my_rio_readlineb(fd, buf, n) <= 0) return -1;}
+
+/* Connection-handling modes, selected with -m */
+#define MODE_THREAD 0 // One detached thread per client (default)
+#define MODE_EPOLL  1 // Single-threaded edge-triggered epoll reactor
+#define MODE_POOL   2 // Prethreaded worker pool fed by a bounded queue
+#define MODE_URING  3 // Reactor on io_uring, falling back to epoll
+
+/* Default worker pool size and connection queue depth */
+#define DEF_WORKERS 16
+#define DEF_QUEUE   256
+
+/* Threads making background refreshes, and refreshes they may have
+ * under way or queued at once; past that, refreshes are dropped
+ */
+#define REFRESHERS    4
+#define REFRESH_SLOTS 64
+
+/* Most request headers that can be made part of the cache key */
+#define MAX_KEY_HEADERS 8
 
 /* You automatically gain 100 points for including this long line in your code */
 static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
@@ -31,57 +57,305 @@ static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64;
 /* Shared web cache */
 cache_t *cache;
 
+/* Connection-handling mode, and number of SO_REUSEPORT listeners
+ * (0 for a single plain listener, one accept loop either way per listener)
+ */
+static int mode = MODE_THREAD;
+static int nacceptors = 0;
+
+/* Cache settings */
+static cache_conf_t cache_conf = {
+	.nshards = DEF_SHARDS,
+	.max_size = MAX_CACHE_SIZE,
+	.max_object_size = MAX_OBJECT_SIZE,
+	.disk_size = DEF_DISK_SIZE
+};
+
+/* Worker pool settings */
+static int nworkers = DEF_WORKERS;	// Number of worker threads
+static int queue_depth = DEF_QUEUE;	// Accepted fds waiting for a worker
+static int reject_full = 0;			// Reply 503 instead of blocking accept
+static sbuf_t conn_queue;			// Accepted fds, shared with workers
+
+/* Request headers whose values are part of the cache key (-k) */
+static char *key_headers[MAX_KEY_HEADERS];
+static int nkey_headers = 0;
+
+/* Freshness lifetime of responses that may be cached but give none (-T) */
+static time_t default_ttl = DEF_TTL;
+
+/* How long objects may be served stale while they are refreshed in the
+ * background, unless they say (-W)
+ */
+static long default_swr = 0;
+
+/* Whether a Range request that misses the cache also has the whole
+ * object fetched for it, in the background (-R)
+ */
+static int range_fill = 1;
+
+/* Background refresh of a stale object (start_refresh) */
+typedef struct Refresh {
+	cache_key_t key;	// Its key, the string on the heap
+	char req[MAXLINE];	// Request forwarded to the server
+	char *host, *port;	// Server
+	flight_t *flight;	// Fetch led by the refresh
+} refresh_t;
+static refresh_t refreshes[REFRESH_SLOTS];
+static sbuf_t refresh_free;			// Slots of refreshes free to take...
+static sbuf_t refresh_queue;		// ... and of those waiting for a thread
+
+/* Cache snapshot file (-S), and the signals that save it */
+static char *snapshot_path;
+static sigset_t snapshot_signals;
+
 /* Client-handling functions */
 void *thread(void *fd); 
+void *worker(void *vargp);
+void *acceptor(void *fd);
+void *snapshotter(void *vargp);
+void *refresher(void *vargp);
+void serve(int listenfd);
+void serve_threads(int listenfd);
+void start_pool(void);
+void start_refreshers(void);
+void serve_pool(int listenfd);
 void process_client_request(int fd);
+void fetch_object(int cp_fd, cache_key_t *key, char *req, char *host,
+				  char *port, flight_t *flight, stale_t *stale,
+				  char *hit_hdrs);
+int follow_flight(int cp_fd, flight_t *flight, cache_key_t *key, char *req);
+void serve_stale(int cp_fd, stale_t *stale, flight_t *flight, char *hit_hdrs);
+void write_hit(int cp_fd, char *hit_hdrs, obj_t *obj, disk_hit_t *hit);
+void fill_for_range(cache_key_t *key, char *req, char *host, char *port);
+void relay_request(int cp_fd, char *req, char *host, char *port);
+ssize_t read_response(rio_t *rp, obj_t *obj, cache_key_t *key,
+					  int cacheable, char *buf, char **data);
 /* Parsing functions */
+int read_req_head(rio_t *rp, char *head);
 int parse_uri(char *uri, char *host, char *path, char *port);
-int parse_req_headers(rio_t *rp, char *extra_headers, char *hdr_host);
-int parse_req_line(rio_t *rp, int cp_fd, char *host, char *path, char *port);
+int parse_req_headers(char *hdrs, char *extra_headers, char *hdr_host,
+					  char *hit_headers);
+int parse_req_line(char *req_line, char *host, char *path, char *port,
+				   char *err);
+int find_header(char *hdrs, char *name, char *value);
+int has_header(char *hdrs, char *name);
+/* Key-building functions */
+int build_key(char *key, char *host, char *port, char *path,
+			  char *hdr_host, char *hdrs);
+int key_header(char *name);
+int variant_key(char *out, cache_key_t *key, char *names, char *req);
+void normalize_list(char *value);
+void normalize_path(char *out, char *path);
+int pct_normalize(char *out, char *in, size_t n);
 /* Error-handling functions */
 void clienterror(int fd, char *cause, char *errnum, 
 		 		 char *shortmsg, char *longmsg);
 /* Self-defined RI/O wrappers */
 ssize_t my_rio_writen(int fd, void *usrbuf, size_t n);
 ssize_t my_rio_readnb(rio_t *rp, void *usrbuf, size_t n);
+ssize_t my_rio_read(rio_t *rp, void *usrbuf, size_t n);
 ssize_t my_rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t my_sendfile(int out_fd, int in_fd, off_t off, size_t n);
+int write_object(int fd, obj_t *obj);
+int write_slice(int fd, obj_t *obj, size_t off, size_t len);
+/* Option functions */
+int set_option(int opt, char *arg);
+int load_config(char *path);
+size_t parse_size(char *s);
 /* Misc functions */
 void memset_str(char *s);
 
 
 /*
  * main - main proxy routine. Reads input port number and opens 
- *		listening connection on it, then handles request/response
- *		transaction.
+ *		listening connection on it, then hands it to the selected
+ *		connection-handling mode:
+ *
+ *		-m thread  one detached thread per client (default)
+ *		-m epoll   single-threaded edge-triggered epoll reactor
+ *		-m uring   the same reactor with batched io_uring submissions
+ *		-m pool    -w worker threads fed by a queue of -q accepted fds;
+ *		           when the queue is full, accept blocks (-f block,
+ *		           default) or the client gets a 503 (-f 503)
+ *
+ *		-a N opens N SO_REUSEPORT listeners (N=0: one per core), each
+ *		with its own accept loop (or event loop, in epoll mode), so the
+ *		kernel spreads new connections across them.
+ *
+ *		-s N splits the cache into N shards (default DEF_SHARDS).
+ *		-c SIZE and -o SIZE set the cache and maximum object sizes,
+ *		with an optional K, M or G suffix.
+ *		-p POLICY picks the cache's eviction policy (default DEF_POLICY).
+ *		-A tinylfu only admits new objects into a full cache when they
+ *		are more popular than what they would evict (default none).
+ *		-k HEADER makes the value of a request header part of the cache
+ *		key (up to MAX_KEY_HEADERS times).
+ *		-d DIR adds a disk tier of -D SIZE (default DEF_DISK_SIZE) in
+ *		directory DIR, holding evicted and large objects.
+ *		-T SECONDS sets how long responses that may be cached, but do
+ *		not say for how long, stay fresh (default DEF_TTL; 0: do not
+ *		cache them).
+ *		-W SECONDS lets objects that do not say otherwise be served for
+ *		that long after going stale, while one background fetch
+ *		refreshes them (default 0).
+ *		-R pass only passes Range requests that miss the cache on to
+ *		the server; -R fill (default) also fetches the whole object
+ *		for the cache in the background.
+ *		-S FILE restores the cache from snapshot FILE at start-up, in
+ *		the background, and saves it there on SIGUSR1, or on SIGINT or
+ *		SIGTERM before exiting.
+ *		-C FILE reads options from a config file (see load_config).
+ *		Later options override earlier ones.
  */
 int main(int argc, char **argv)
 {
-	int *cp_fd;	  // Client/proxy connection fd
+	int i, opt, *fd;
     int listenfd; // Proxy listening fd
     pthread_t tid;
     char *listen_port;
-    socklen_t clientlen;
-    struct sockaddr_in clientaddr;
 
     /* Ignore SIGPIPE signals */
     Signal(SIGPIPE, SIG_IGN);
 
-    /* Initialize cache */
-    cache = cache_init();
+    /* Parse command line options */
+    while ((opt = getopt(argc, argv, "m:w:q:f:a:s:c:o:p:A:k:d:D:T:W:R:S:C:")) != -1)
+    {
+    	if (opt == 'C' && load_config(optarg) < 0)
+    		exit(1);
+    	else if (opt != 'C' && set_option(opt, optarg) < 0)
+    		break;
+    }
 
     /* Check command line args */
-    if (argc != 2) 
+    if (opt != -1 || argc - optind != 1) 
     {
-		fprintf(stderr, "usage: %s <port>\n", argv[0]);
+		fprintf(stderr, "usage: %s [-m thread|epoll|uring|pool] [-w workers] "
+				"[-q queue] [-f block|503] [-a acceptors] [-s shards] "
+				"[-c cache_size] [-o object_size] [-p lru|s3fifo|arc|gdsf] "
+				"[-A none|tinylfu] [-k key_header]... [-d disk_dir] "
+				"[-D disk_size] [-T default_ttl] [-W stale_while_revalidate] "
+				"[-R fill|pass] [-S snapshot] [-C config] <port>\n",
+				argv[0]);
 		exit(1);
     }
-    listen_port = argv[1];
+    listen_port = argv[optind];
+
+    /* Initialize cache */
+    if (!cache_conf.policy)
+    	cache_conf.policy = policy_find(DEF_POLICY);
+    if (!(cache = cache_init(&cache_conf)))
+    	exit(1);
+
+    /* Warm the cache up from the last snapshot. Snapshot signals are
+     * blocked before any other thread starts, so that only snapshotter
+     * takes them.
+     */
+    if (snapshot_path)
+    {
+    	sigemptyset(&snapshot_signals);
+    	sigaddset(&snapshot_signals, SIGUSR1);
+    	sigaddset(&snapshot_signals, SIGINT);
+    	sigaddset(&snapshot_signals, SIGTERM);
+    	pthread_sigmask(SIG_BLOCK, &snapshot_signals, NULL);
+    	if (snapshot_load(cache, snapshot_path) < 0)
+    		exit(1);
+    	Pthread_create(&tid, NULL, snapshotter, NULL);
+    }
+
+    /* Workers are shared by all accept loops, and so are refreshers */
+    if (mode == MODE_POOL)
+    	start_pool();
+    start_refreshers();
+
+    /* Give every extra SO_REUSEPORT listener its own accept loop */
+    for (i = 1; i < nacceptors; i++)
+    {
+    	fd = Malloc(sizeof(int));
+    	*fd = Open_reuseport_listenfd(listen_port);
+    	Pthread_create(&tid, NULL, acceptor, fd);
+    }
 
     /* Check if listening port opened */
-    if ((listenfd = Open_listenfd(listen_port)) < 0)
+    if (nacceptors)
+    	listenfd = Open_reuseport_listenfd(listen_port);
+    else if ((listenfd = Open_listenfd(listen_port)) < 0)
     	exit(1);
 
     /* Main server loop */
+    serve(listenfd);
+
+    /* Free cache elements when done */
+    free_cache(cache);
+
+    return 0;
+}
+
+
+/*********************************/
+/*** CLIENT-HANDLING FUNCTIONS ***/
+/*********************************/
+
+/*
+ * serve - run the selected mode's accept loop on listenfd forever
+ */
+void serve(int listenfd)
+{
+    if (mode == MODE_EPOLL || mode == MODE_URING)
+    	reactor_run(listenfd, mode == MODE_URING);
+    else if (mode == MODE_POOL)
+    	serve_pool(listenfd);
+    else
+    	serve_threads(listenfd);
+}
+
+/*
+ * acceptor - thread function running the accept loop of an extra
+ *		SO_REUSEPORT listener
+ */
+void *acceptor(void *fd)
+{
+	/* Save the passed fd value and free it */
+	int listenfd = *((int *)fd);
+	Free(fd);
+	Pthread_detach(Pthread_self());
+	serve(listenfd);
+	return NULL;
+}
+
+/*
+ * snapshotter - thread function saving the cache snapshot whenever a
+ *		snapshot signal arrives; SIGINT and SIGTERM then end the proxy
+ */
+void *snapshotter(void *vargp)
+{
+	int sig;
+
+	Pthread_detach(Pthread_self());
+	while (1)
+	{
+		if (sigwait(&snapshot_signals, &sig))
+			continue;
+		/* Saving mid-restore would lose what is not loaded yet */
+		snapshot_wait();
+		snapshot_save(cache, snapshot_path);
+		if (sig != SIGUSR1)
+			exit(0);
+	}
+	return NULL;
+}
+
+/*
+ * serve_threads - accept clients forever, creating a new detached
+ *		thread for every accepted connection
+ */
+void serve_threads(int listenfd)
+{
+	int *cp_fd;	  // Client/proxy connection fd
+    pthread_t tid;
+    socklen_t clientlen;
+    struct sockaddr_in clientaddr;
+
     while (1) 
     {
 		clientlen = sizeof(clientaddr);
@@ -90,17 +364,64 @@ int main(int argc, char **argv)
 		/* Create a new thread to deal with client request */
 		Pthread_create(&tid, NULL, thread, cp_fd);
     }
+}
 
-    /* Free cache elements when done */
-    free_cache(cache);
+/*
+ * start_pool - create the connection queue and the worker threads
+ */
+void start_pool(void)
+{
+	int i;
+    pthread_t tid;
 
-    return 0;
+    sbuf_init(&conn_queue, queue_depth);
+    for (i = 0; i < nworkers; i++)
+    	Pthread_create(&tid, NULL, worker, NULL);
 }
 
+/*
+ * serve_pool - accept clients forever and queue them for the workers.
+ *		When the queue is full, either wait for a free slot or turn
+ *		the client away with a 503.
+ */
+void serve_pool(int listenfd)
+{
+	int cp_fd;
+    socklen_t clientlen;
+    struct sockaddr_in clientaddr;
 
-/*********************************/
-/*** CLIENT-HANDLING FUNCTIONS ***/
-/*********************************/
+    while (1) 
+    {
+		clientlen = sizeof(clientaddr);
+		cp_fd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
+		if (!reject_full)
+			sbuf_insert(&conn_queue, cp_fd);
+		else if (sbuf_tryinsert(&conn_queue, cp_fd) < 0) {
+			clienterror(cp_fd, "queue", "503", "Service Unavailable",
+					"Proxy is overloaded, try again later");
+			Close(cp_fd);
+		}
+    }
+}
+
+/*
+ * worker - pool thread function that handles queued clients forever
+ */
+void *worker(void *vargp)
+{
+	int cp_fd;
+
+	/* Run in detached mode */
+	Pthread_detach(Pthread_self());
+	while (1)
+	{
+		cp_fd = sbuf_remove(&conn_queue);
+		/* Process client's request and close connection when done */
+		process_client_request(cp_fd);
+		Close(cp_fd);
+	}
+	return NULL;
+}
 
 /*
  * thread - thread function that handles client requests
@@ -128,89 +449,447 @@ void *thread(void *fd)
 void process_client_request(int cp_fd) 
 {
 	rio_t rio;
-    int ps_fd; 			// Proxy/server fd 
     line_t *line; 		// Cache line containing web object
-    char buf[MAXLINE];  // Reding buffer
-    char extra_headers[MAXLINE], hdr_host[MAXLINE];
-    char host[MAXLINE], path[MAXLINE], port[MAXLINE];  
-    
-    /* Reset all used strings */
-    memset(buf, 0, MAXLINE-1);
-    memset(host, 0, MAXLINE-1);
-    memset(path, 0, MAXLINE-1);
-    memset(port, 0, MAXLINE-1);
-    memset(hdr_host, 0, MAXLINE-1);
-    memset(extra_headers, 0, MAXLINE-1);
-
-    /* Parse request line and fill in passed pointers on success */
-    if(parse_req_line(&rio, cp_fd, host, path, port) < 0)
+    disk_hit_t hit;		// Web object found in the disk tier
+    stale_t stale;		// Stale copy of it, if any
+    flight_t *flight;	// Fetch of the web object shared with other clients
+    int leader;			// Whether this client makes that fetch
+    char buf[MAXLINE];  // Reading buffer
+    char head[MAXLINE]; // Client request line and headers
+    char req[MAXLINE];  // Request forwarded to the server
+    char key[MAXLINE];  // Normalized request, the cache key
+    char hit_hdrs[MAXLINE]; // Request headers answered from the cache
+    cache_key_t ckey;
+    char host[MAXLINE], port[MAXLINE];  
+
+    /* Read the client's request line and headers */
+    Rio_readinitb(&rio, cp_fd);
+    if (read_req_head(&rio, head) < 0)
     	return;
 
-    /* Parse request headers and check for non-default headers */
-    if(parse_req_headers(&rio, extra_headers, hdr_host) < 0)
+    /* Parse the request and build the one forwarded to the server;
+     * buf holds the error page to send back on failure
+     */
+    if (build_request(head, req, key, host, port, hit_hdrs, buf) < 0) {
+    	RIOWRITEN(cp_fd, buf, strlen(buf));
     	return;
-
-    /*** Building request to be forwarded to server ***/
-    /* Write request line */
-    sprintf(buf, "GET %s HTTP/1.0\r\n", path);
-    /* Write request headers */
-    /* Check if Host header was specified in client request */
-    if (hdr_host == NULL)
-    	/* Write header-specified host */
-    	sprintf(buf, "%sHost: %s\r\n", buf, hdr_host);
-    else
-    	/* Use host provided in URI otherwise */
-    	sprintf(buf, "%sHost: %s\r\n", buf, host);
-    /* Write rest of default headers */
-    sprintf(buf, "%s%s", buf, user_agent_hdr);
-    sprintf(buf, "%sConnection: close\r\n", buf);
-    sprintf(buf, "%sProxy-connection: close\r\n", buf);
-    /* Forward additional headers, if any */
-    if (extra_headers == NULL)
-    	sprintf(buf, "%s\r\n", buf);
-   	else
-   		sprintf(buf, "%s%s", buf, extra_headers);
+    }
+    /* A private request (no key) is passed on as is, uncached */
+    if (!*key) {
+    	client_request(req, hit_hdrs);
+    	relay_request(cp_fd, req, host, port);
+    	return;
+    }
+    cache_key(&ckey, key);
+    /* Look for the variant of the object the request selects, if the
+     * object is known to vary on request headers
+     */
+    select_variant(&ckey, key, req);
 
    	/* Check the cache for request;
-   	 * Returns the cache line if found, otherwise NULL 
+   	 * Returns the cache line, pinned, if found, otherwise NULL 
+   	 */
+   	line = in_cache(cache, &ckey); //// CACHE READ ////
+   	/* Write back to client directly from the cache if cache hit
+   	 * (the ranges asked for, if any)
    	 */
-   	line = in_cache(cache, buf); //// CACHE READ ////
-   	/* Write back to client directly if cache hit */
    	if (line) {
-   		RIOWRITEN(cp_fd, line->web_obj, line->size);
+   		write_hit(cp_fd, hit_hdrs, &line->body, NULL);
+   		release_line(line);
+   	}
+   	/* Or straight from the disk tier's page cache if found there */
+   	else if (!in_disk(cache, &ckey, &hit)) {
+   		write_hit(cp_fd, hit_hdrs, NULL, &hit);
+   		disk_release(&hit);
+   	}
+   	/* Or from a copy stale for less than its stale-while-revalidate
+   	 * window, which one background fetch refreshes meanwhile
+   	 */
+   	else if (!find_stale(cache, &ckey, &stale) && stale_usable(&stale)) {
+   		/* Start the refresh first, not to hold it up for as long as
+   		 * a slow client takes to read the copy
+   		 */
+   		flight = flight_join(cache, &ckey, &leader);
+   		if (leader)
+   			start_refresh(&ckey, req, host, port, flight);
+   		else
+   			flight_release(flight);
+   		write_hit(cp_fd, hit_hdrs, stale.line ? &stale.line->body : NULL,
+   				  &stale.hit);
+   		release_stale(&stale);
+   	}
+   	/* A Range request that misses is passed on to the server as is,
+   	 * while the whole object may be fetched for the cache; so is a
+   	 * conditional one, unless there is a stale copy to revalidate
+   	 */
+   	else if (has_header(hit_hdrs, "Range") ||
+   			 (*hit_hdrs && !stale.head)) {
+   		release_stale(&stale);
+   		if (has_header(hit_hdrs, "Range"))
+   			fill_for_range(&ckey, req, host, port);
+   		client_request(req, hit_hdrs);
+   		relay_request(cp_fd, req, host, port);
    	}
    	/* Otherwise connect to server and forward the request */
    	else {
-   		/* Connect server to proxy */
-    	if ((ps_fd = Open_clientfd(host, port)) < 0) {
-    		clienterror(cp_fd, "request_line", "400", "Bad request",
-                	"Proxy could not understand the request");
-    		return;
-    	}
-    	/* Initialize cache variables */
-   		char req[MAXLINE]; 	// Client request and web object
-   		size_t s = 0;		// Size of web object
-   		ssize_t nread;		// Bytes read from server
-   		char web_obj[MAX_OBJECT_SIZE]; // Web object received from server
-   		/* Initialize rio to proxy/server connection */
-   		Rio_readinitb(&rio, ps_fd);
-   		/* Save the built request */ 
-   		strcpy(req, buf);
-   		/* Send the built request to server */
-   		RIOWRITEN(ps_fd, buf, strlen(buf)); 
-    	/* Read server response and write to client */
-		while((nread = my_rio_readnb(&rio, buf, MAXLINE)) != 0)
-		{	
-			/* Write back to client */
-			RIOWRITEN(cp_fd, buf, nread); 
-			/* Update web object for caching */
-			memcpy(web_obj+s, buf, nread);
-			/* Update web object size */
-			s += nread;
+   		/* Unless another client is fetching it already: then follow */
+   		flight = flight_join(cache, &ckey, &leader);
+   		if (!leader) {
+   			release_stale(&stale);
+   			/* Pass the request on as is if the response turns out
+   			 * to be another variant of the object, or not to be shared
+   			 */
+   			if (follow_flight(cp_fd, flight, &ckey, req) < 0) {
+   				client_request(req, hit_hdrs);
+   				relay_request(cp_fd, req, host, port);
+   			}
+   			flight_release(flight);
+   			return;
+   		}
+   		fetch_object(cp_fd, &ckey, req, host, port, flight, &stale,
+   					 hit_hdrs);
+	}
+}
+
+/*
+ * fetch_object - as the leader of a fetch (flight), forward the request
+ *		built for the server (req) and relay the response back to the
+ *		client and the followers, then cache it under key. A stale copy
+ *		of the object (stale, pinned, or with data NULL to look one up)
+ *		is revalidated instead of fetched again, and released; once
+ *		confirmed, it is served as a cache hit would be, hit_hdrs being
+ *		the client's headers answered from the cache (or NULL). A
+ *		response that varies on request headers is cached under the key
+ *		of the variant req selects instead.
+ *		cp_fd is -1 for a fetch no client waits on.
+ */
+void fetch_object(int cp_fd, cache_key_t *key, char *req, char *host,
+				  char *port, flight_t *flight, stale_t *stale,
+				  char *hit_hdrs)
+{
+	rio_t rio;
+	int ps_fd; 			// Proxy/server fd
+	char buf[MAXLINE];  // Reading buffer, once the object is not cached
+	char *data = buf;	// Where the bytes last read went
+	ssize_t nread;		// Bytes read from server
+	obj_t obj = { NULL, NULL, 0 }; // Web object received from server
+	int cacheable = 1;	// Whether it still fits in a cache line
+	int head = 0;		// Whether its head is in
+	int rv;
+	size_t len;			// Length of the request before any validators
+	time_t expires = 0;	// When it goes stale, if cacheable
+	cache_key_t store = *key; // Key it is cached under...
+	char vkey[MAXLINE];	// ... if that of a variant, the string
+
+	/* Revalidate a stale copy, if there is one, instead of fetching
+	 * the object again
+	 */
+	len = strlen(req);
+	if ((stale->head || !find_stale(cache, key, stale)) &&
+		conditional_request(req, stale->head, stale->head_len) < 0)
+		release_stale(stale);
+	/* Fetch it; at most twice, if the answer to revalidation is fetched
+	 * again without the condition (the stale copy is released then)
+	 */
+	while (1)
+	{
+		/* Connect server to proxy */
+		if ((ps_fd = Open_clientfd(host, port)) < 0) {
+			flight_finish(flight, 0);
+			release_stale(stale);
+			if (cp_fd >= 0)
+				clienterror(cp_fd, "request_line", "400", "Bad request",
+							"Proxy could not understand the request");
+			return;
+		}
+		/* Initialize rio to proxy/server connection */
+		Rio_readinitb(&rio, ps_fd);
+		/* Send the built request to server */
+		if (my_rio_writen(ps_fd, req, strlen(req)) < 0) {
+			flight_finish(flight, 0);
+			release_stale(stale);
+			Close(ps_fd);
+			return;
+		}
+		if (!stale->head) {
+			nread = read_response(&rio, &obj, key, cacheable, buf, &data);
+			break;
+		}
+		/* If revalidating, the head of the response tells whether the
+		 * stale copy is still good: if so, serve it instead
+		 */
+		if (!read_req_head(&rio, buf) &&
+			(rv = revalidate_stale(key, stale, req, buf, strlen(buf))) >= 0) {
+			if (rv > 0) {
+				serve_stale(cp_fd, stale, flight, hit_hdrs);
+				release_stale(stale);
+				Close(ps_fd);
+				return;
+			}
+			release_stale(stale);
+			nread = strlen(buf);
+			break;
+		}
+		/* A head too long to tell, or cut short, may be that of a 304
+		 * the client did not ask for: never relay it, but ask again
+		 * without the validators
+		 */
+		release_stale(stale);
+		Close(ps_fd);
+		strcpy(req + len - 2, "\r\n");
+	}
+	/* Read server response and write to client */
+	while (nread > 0)
+	{
+		/* Take the bytes into the web object while it still fits:
+		 * as they are if read straight into it, else by copy
+		 */
+		if (cacheable && data != buf)
+			obj_commit(&obj, nread);
+		else if (cacheable)
+			cacheable = !append_object(&obj, key, buf, nread);
+		/* Write back to client; if it is gone, carry on fetching
+		 * only for the sake of followers
+		 */
+		if (cp_fd >= 0 && my_rio_writen(cp_fd, data, nread) < 0) {
+			if (!flight_followers(flight))
+				break;
+			cp_fd = -1;
+		}
+		/* Feed the followers */
+		flight_append(cache, flight, cacheable ? &obj : NULL, data,
+					  nread);
+		/* Once the head is in, stop filling if the response rules
+		 * caching out, and tell the followers which variant it is,
+		 * or that it is not theirs to have
+		 */
+		if (!head && (rv = cacheable ? response_freshness(&obj, &store,
+									 req, vkey, &expires) : 0) >= 0) {
+			cacheable = rv;
+			flight_variant(flight, rv ? store.str : NULL);
+			head = 1;
+		}
+		/* Past what the cache would keep, let lagging followers catch
+		 * up before reading on
+		 */
+		flight_room(cache, flight, 1);
+		nread = read_response(&rio, &obj, key, cacheable, buf, &data);
+	}
+	Close(ps_fd);
+	/* Add the web object to the cache if it was relayed in full */
+	if (nread == 0 && cacheable && expires)
+		add_object(cache, &store, &obj, expires); //// CACHE WRITE ////
+	flight_finish(flight, nread == 0);
+	free_object(&obj, key);
+}
+
+/*
+ * start_refreshers - create the background refresh queue and the
+ *		threads working it (refresher)
+ */
+void start_refreshers(void)
+{
+	int i;
+	pthread_t tid;
+
+	sbuf_init(&refresh_free, REFRESH_SLOTS);
+	sbuf_init(&refresh_queue, REFRESH_SLOTS);
+	for (i = 0; i < REFRESH_SLOTS; i++)
+		sbuf_insert(&refresh_free, i);
+	for (i = 0; i < REFRESHERS; i++)
+		Pthread_create(&tid, NULL, refresher, NULL);
+}
+
+/*
+ * start_refresh - queue a fetch (flight) refreshing the object under key,
+ *		that no client waits on, for a background thread (refresher).
+ *		With every slot taken, the refresh is dropped instead: its
+ *		followers fetch for themselves, and the next request to find the
+ *		object stale tries again.
+ */
+void start_refresh(cache_key_t *key, char *req, char *host, char *port,
+				   flight_t *flight)
+{
+	int i;
+	refresh_t *r;
+
+	if ((i = sbuf_tryremove(&refresh_free)) < 0) {
+		flight_variant(flight, NULL);
+		flight_finish(flight, 0);
+		return;
+	}
+
+	r = &refreshes[i];
+	r->key = *key;
+	r->key.str = (char *)Malloc(key->len + 1);
+	strcpy(r->key.str, key->str);
+	strcpy(r->req, req);
+	r->host = (char *)Malloc(strlen(host) + 1);
+	strcpy(r->host, host);
+	r->port = (char *)Malloc(strlen(port) + 1);
+	strcpy(r->port, port);
+	r->flight = flight;
+	sbuf_insert(&refresh_queue, i);
+}
+
+/*
+ * refresher - thread function making queued background refresh fetches
+ *		forever
+ */
+void *refresher(void *vargp)
+{
+	int i;
+	refresh_t *r;
+	stale_t stale;
+
+	Pthread_detach(Pthread_self());
+	while (1)
+	{
+		i = sbuf_remove(&refresh_queue);
+		r = &refreshes[i];
+		memset(&stale, 0, sizeof(stale_t));
+		fetch_object(-1, &r->key, r->req, r->host, r->port, r->flight,
+					 &stale, NULL);
+
+		Free(r->key.str);
+		Free(r->host);
+		Free(r->port);
+		sbuf_insert(&refresh_free, i);
+	}
+	return NULL;
+}
+
+/*
+ * follow_flight - write the response of a fetch led by another client
+ *		back to the client (its request req, under key), as it arrives.
+ *		Returns 0 on success, -1 if the response is another variant of
+ *		the object than the client asked for, or not to be shared (none
+ *		of it is written).
+ */
+int follow_flight(int cp_fd, flight_t *flight, cache_key_t *key, char *req)
+{
+	char *data;
+	ssize_t n;
+	flight_pos_t pos = { NULL, 0, 0 };
+
+	while ((n = flight_read(flight, &pos, &data, 1)) > 0)
+	{
+		if (pos.read == (size_t)n && !same_variant(flight, key, req)) {
+			n = FLIGHT_PASS;
+			break;
 		}
-		/* Add the web object to the cache */
-		add_object(cache, req, web_obj, s); //// CACHE WRITE ////
+		if (my_rio_writen(cp_fd, data, n) < 0)
+			break;
 	}
+	flight_unfollow(flight, &pos);
+	if (n == FLIGHT_PASS)
+		return -1;
+
+	/* The leader could not reach the server */
+	if (n < 0 && !pos.read)
+		clienterror(cp_fd, "request_line", "400", "Bad request",
+					"Proxy could not understand the request");
+	return 0;
+}
+
+/*
+ * serve_stale - write a stale copy that the server confirmed unchanged
+ *		back to the client (see write_hit), and feed it to the followers
+ *		of the fetch
+ */
+void serve_stale(int cp_fd, stale_t *stale, flight_t *flight, char *hit_hdrs)
+{
+	feed_stale(flight, stale);
+	flight_finish(flight, 1);
+
+	if (cp_fd >= 0)
+		write_hit(cp_fd, hit_hdrs, stale->line ? &stale->line->body : NULL,
+				  &stale->hit);
+}
+
+/*
+ * write_hit - write a cached object back to the client: a line's (obj),
+ *		or else a disk tier object (hit), straight from the page cache.
+ *		hit_hdrs holds the request's headers answered from the cache, or
+ *		is NULL: a client revalidating its own copy gets a 304 if it is
+ *		still good, and a Range request the ranges it asks for.
+ */
+void write_hit(int cp_fd, char *hit_hdrs, obj_t *obj, disk_hit_t *hit)
+{
+	int i;
+	size_t n;
+	char buf[MAXLINE];
+	http_partial_t part;
+
+	if ((n = not_modified_reply(buf, hit_hdrs, obj, hit))) {
+		my_rio_writen(cp_fd, buf, n);
+		return;
+	}
+
+	if (partial_reply(&part, hit_hdrs, obj, hit) < 0) {
+		if (obj)
+			write_object(cp_fd, obj);
+		else
+			my_sendfile(cp_fd, hit->seg->fd, hit->off, hit->size);
+		return;
+	}
+
+	for (i = 0; i <= part.n; i++)
+	{
+		if (my_rio_writen(cp_fd, part.text[i], part.text_len[i]) < 0 ||
+			i == part.n)
+			return;
+		if (obj && write_slice(cp_fd, obj, part.off[i], part.len[i]) < 0)
+			return;
+		if (!obj && my_sendfile(cp_fd, hit->seg->fd, hit->off + part.off[i],
+								part.len[i]) < 0)
+			return;
+	}
+}
+
+/*
+ * fill_for_range - start fetching the whole object under key in the
+ *		background, for a Range request that missed the cache (req
+ *		being the request for it), unless -R pass or a fetch of it is
+ *		already under way
+ */
+void fill_for_range(cache_key_t *key, char *req, char *host, char *port)
+{
+	int leader;
+	flight_t *flight;
+
+	if (!range_fill)
+		return;
+
+	flight = flight_join(cache, key, &leader);
+	if (leader)
+		start_refresh(key, req, host, port, flight);
+	else
+		flight_release(flight);
+}
+
+/*
+ * relay_request - forward a request that is not to be cached (req) to
+ *		the server and relay its response back to the client
+ */
+void relay_request(int cp_fd, char *req, char *host, char *port)
+{
+	rio_t rio;
+	int ps_fd;
+	char buf[MAXLINE];
+	ssize_t nread;
+
+	if ((ps_fd = Open_clientfd(host, port)) < 0) {
+		clienterror(cp_fd, "request_line", "400", "Bad request",
+					"Proxy could not understand the request");
+		return;
+	}
+	Rio_readinitb(&rio, ps_fd);
+	if (my_rio_writen(ps_fd, req, strlen(req)) >= 0)
+		while ((nread = my_rio_read(&rio, buf, MAXLINE)) > 0 &&
+			   my_rio_writen(cp_fd, buf, nread) >= 0)
+			;
+	Close(ps_fd);
 }
 
 /*************************************/
@@ -223,86 +902,210 @@ void process_client_request(int cp_fd)
 /*************************/
 
 /*
- * parse_req_headers - read and parse HTTP request headers, ignoring values
+ * read_req_head - read the client's request line and headers, up to and
+ *				including the empty line ending them, into head (MAXLINE).
+ *				Also reads the status line and headers of a response.
+ *				Returns 0 on success, -1 on error or if the head is too long.
+ */
+int read_req_head(rio_t *rp, char *head)
+{
+	char buf[MAXLINE];
+	size_t len = 0, n;
+
+	do {
+		/* Read the next line of the request head */
+		RIOREADLINEB(rp, buf, MAXLINE);
+		if ((n = strlen(buf)) >= MAXLINE - len)
+			return -1;
+		memcpy(head + len, buf, n + 1);
+		len += n;
+	} while (!req_head_complete(head));
+
+	return 0;
+}
+
+/*
+ * req_head_complete - check whether head holds a full request line and
+ *				header block, i.e. ends with an empty line.
+ *				Returns 1 if true, 0 otherwise
+ */
+int req_head_complete(char *head)
+{
+	return strstr(head, "\r\n\r\n") || strstr(head, "\n\n") ||
+		   strstr(head, "\n\r\n");
+}
+
+/*
+ * build_request - parse a complete client request head and build the
+ *				request to be forwarded to the server into req (MAXLINE)
+ *				and its cache key into key (MAXLINE), filling in host and
+ *				port (MAXLINE each). The client's Range and conditional
+ *				headers are kept out of req, in hit_hdrs (MAXLINE): the
+ *				whole object is what gets fetched and cached, and they
+ *				are answered from it. head is modified.
+ *				Returns 0 on success; on error writes the error page for
+ *				the client into err (MAXLINE) and returns -1.
+ */
+int build_request(char *head, char *req, char *key, char *host, char *port,
+				  char *hit_hdrs, char *err)
+{
+	int rc;
+	char *hdrs;
+	char path[MAXLINE], hdr_host[MAXLINE], extra_headers[MAXLINE];
+
+	/* Reset all used strings */
+	memset(host, 0, MAXLINE);
+	memset(port, 0, MAXLINE);
+	memset(path, 0, MAXLINE);
+	memset(hdr_host, 0, MAXLINE);
+	memset(extra_headers, 0, MAXLINE);
+	memset(hit_hdrs, 0, MAXLINE);
+
+	/* Split the request line from the headers */
+	if ((hdrs = strchr(head, '\n')))
+		*hdrs++ = '\0';
+	else
+		hdrs = head + strlen(head);
+
+	/* Parse request line and fill in passed pointers on success */
+	if (parse_req_line(head, host, path, port, err) < 0)
+		return -1;
+
+	/* Parse request headers and check for non-default headers */
+	if (parse_req_headers(hdrs, extra_headers, hdr_host, hit_hdrs) < 0) {
+		build_clienterror(err, MAXLINE, "request_headers", "400",
+				"Bad request", "Proxy could not understand the headers");
+		return -1;
+	}
+
+	/*** Building request to be forwarded to server ***/
+	/* Request line, then the Host header: the one specified in the
+	 * client request if any, otherwise the host provided in the URI.
+	 * The rest of the default headers and any additional ones follow.
+	 */
+	if (snprintf(req, MAXLINE, "GET %s HTTP/1.0\r\n"
+				 "Host: %s\r\n"
+				 "%s"
+				 "Connection: close\r\n"
+				 "Proxy-connection: close\r\n"
+				 "%s",
+				 path, *hdr_host ? hdr_host : host, user_agent_hdr,
+				 extra_headers) >= MAXLINE) {
+		build_clienterror(err, MAXLINE, "request", "400", "Bad request",
+				"Request is too long");
+		return -1;
+	}
+
+	/* Key the cache on what identifies the response, not on the text
+	 * of the forwarded request; a private request gets no key
+	 */
+	if ((rc = build_key(key, host, port, path, hdr_host,
+						extra_headers)) < 0) {
+		build_clienterror(err, MAXLINE, "request", "400", "Bad request",
+				"Request is too long");
+		return -1;
+	}
+	if (rc > 0)
+		*key = '\0';
+
+	return 0;
+}
+
+/*
+ * parse_req_headers - parse HTTP request headers, ignoring values
  * 				given for Host, User-Agent, Connection, and Proxy-connection. 
+ *				Range and conditional headers go to hit_headers.
  *				Returns 0 on success, -1 on error.
  */
-int parse_req_headers(rio_t *rp, char *extra_headers, char *hdr_host) 
+int parse_req_headers(char *hdrs, char *extra_headers, char *hdr_host,
+					  char *hit_headers) 
 {
-    char buf[MAXLINE];
+	char *buf, *next;
+	size_t n;
 
-    /* Reset all used strings */
-    memset_str(buf);
-
-    /* Read the first request header */
-    RIOREADLINEB(rp, buf, MAXLINE);
-    /* Read the rest, if any */
-    while(strcmp(buf, "\r\n")) {
-    	/* Check for "Host:" header */
-    	if (strstr(buf, "Host:"))
-    	{	
-    		/* Skip "Host: " and "\r\n" and copy into host */
-    		strncpy(hdr_host, buf+6, strlen(buf+6)-2);
-    		/* Add a null terminator */
-    		strcat(hdr_host, "");
-    	}
-    	/* Ignore default headers */
-    	else if (!strstr(buf, "Connection:") && 
-    			!strstr(buf, "Proxy-connection:") && 
-    			!strstr(buf, "User-Agent:"))
-    	{
-    		/* Add any other extra headers */
-    		strcat(extra_headers, buf);
-    	}
-    	/* Read next header */
-    	RIOREADLINEB(rp, buf, MAXLINE);
-    }
+	for (buf = hdrs; *buf && *buf != '\r' && *buf != '\n'; buf = next)
+	{
+		/* Find the start of the next header */
+		next = strchr(buf, '\n');
+		next = next ? next + 1 : buf + strlen(buf);
+		n = next - buf;
+
+		/* Check for "Host:" header */
+		if (!strncasecmp(buf, "Host:", 5))
+		{
+			/* Skip "Host:" and surrounding whitespace and copy into host */
+			for (buf += 5; *buf == ' ' || *buf == '\t'; buf++)
+				;
+			for (n = next - buf; n && isspace(buf[n-1]); n--)
+				;
+			if (n >= MAXLINE)
+				return -1;
+			memcpy(hdr_host, buf, n);
+			hdr_host[n] = '\0';
+		}
+		/* Keep ranges and validators apart, to be answered from the
+		 * whole object
+		 */
+		else if (!strncasecmp(buf, "Range:", 6) ||
+				 !strncasecmp(buf, "If-Range:", 9) ||
+				 !strncasecmp(buf, "If-None-Match:", 14) ||
+				 !strncasecmp(buf, "If-Modified-Since:", 18))
+		{
+			if (strlen(hit_headers) + n + 1 > MAXLINE)
+				return -1;
+			strncat(hit_headers, buf, n);
+		}
+		/* Ignore default headers */
+		else if (strncasecmp(buf, "Connection:", 11) &&
+				strncasecmp(buf, "Proxy-connection:", 17) &&
+				strncasecmp(buf, "User-Agent:", 11))
+		{
+			/* Add any other extra headers */
+			if (strlen(extra_headers) + n + 3 > MAXLINE)
+				return -1;
+			strncat(extra_headers, buf, n);
+		}
+	}
 
-    /* Terminate the header string according to RFC 1945 specs */
-    strcat(extra_headers, "\r\n");
+	/* Terminate the header string according to RFC 1945 specs */
+	strcat(extra_headers, "\r\n");
 
-    return 0;
+	return 0;
 }
 
 /*
- * parse_req_line - read and parse HTTP request line for host, path, and port,
- *				while making checks for client errors
+ * parse_req_line - parse HTTP request line for host, path, and port,
+ *				while making checks for client errors.
+ *				Returns 0 on success; writes the error page into err
+ *				(MAXLINE) and returns -1 otherwise.
  */
-int parse_req_line(rio_t *rp, int cp_fd, char *host, char *path, char *port)
+int parse_req_line(char *req_line, char *host, char *path, char *port,
+				   char *err)
 {
-    char buf[MAXLINE]; 
     char method[MAXLINE], uri[MAXLINE], version[MAXLINE];
 
     /* Reset all used strings */
-    memset_str(buf);
     memset_str(uri);
     memset_str(version);
     memset_str(method);
 
-    /* Read request line */
-    Rio_readinitb(rp, cp_fd);
-    /* Fill buffer with first request header */
-    RIOREADLINEB(rp, buf, MAXLINE);
-
     /* Check that request line contains three strings (method URI version) */
-    if (sscanf(buf, "%s %s %s", method, uri, version) != 3) {
-        clienterror(cp_fd, "request_line", "400", "Bad request",
+    if (sscanf(req_line, "%s %s %s", method, uri, version) != 3) {
+        build_clienterror(err, MAXLINE, "request_line", "400", "Bad request",
                 "Proxy requires: method URI version");
         return -1;
     }
     
     /* Check that version is "HTTP/1.0" or "HTTP/1.1" */
     if (strcasecmp(version, "HTTP/1.0") && strcasecmp(version, "HTTP/1.1")) { 
-        clienterror(cp_fd, version, "501", "Not implemented",
+        build_clienterror(err, MAXLINE, version, "501", "Not implemented",
                 "Proxy does not implement this version");
         return -1;
     }
-    /* Forwarded version is always HTTP/1.0 */
-    strcpy(version, "HTTP/1.0");
   	
   	/* Check that method is "GET" */
     if (strcasecmp(method, "GET")) { 
-        clienterror(cp_fd, method, "501", "Not Implemented",
+        build_clienterror(err, MAXLINE, method, "501", "Not Implemented",
                 "Proxy does not implement this method");
         return -1;
     }
@@ -310,7 +1113,7 @@ int parse_req_line(rio_t *rp, int cp_fd, char *host, char *path, char *port)
     /* Update host, path, and port values */
     if (parse_uri(uri, host, path, port) < 0)
     {
-    	clienterror(cp_fd, "request_line", "400", "Bad request",
+    	build_clienterror(err, MAXLINE, "request_line", "400", "Bad request",
                 "Proxy could not understand the request");
         return -1;
     }
@@ -318,6 +1121,47 @@ int parse_req_line(rio_t *rp, int cp_fd, char *host, char *path, char *port)
     return 0;
 }
 
+/*
+ * find_header - find the header called name in hdrs, copying its value,
+ *		without surrounding whitespace, into value (MAXLINE).
+ *		Returns 0 if found, -1 otherwise.
+ */
+int find_header(char *hdrs, char *name, char *value)
+{
+	char *buf, *next;
+	size_t n, len = strlen(name);
+
+	for (buf = hdrs; *buf && *buf != '\r' && *buf != '\n'; buf = next)
+	{
+		next = strchr(buf, '\n');
+		next = next ? next + 1 : buf + strlen(buf);
+
+		if (strncasecmp(buf, name, len) || buf[len] != ':')
+			continue;
+		for (buf += len + 1; *buf == ' ' || *buf == '\t'; buf++)
+			;
+		for (n = next - buf; n && isspace(buf[n-1]); n--)
+			;
+		if (n >= MAXLINE)
+			return -1;
+		memcpy(value, buf, n);
+		value[n] = '\0';
+		return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * has_header - Returns whether hdrs has a header called name
+ */
+int has_header(char *hdrs, char *name)
+{
+	char value[MAXLINE];
+
+	return !find_header(hdrs, name, value);
+}
+
 /*
  * parse_uri - parse URI into host, path, and port arguments
  */
@@ -337,6 +1181,9 @@ int parse_uri(char *uri, char *host, char *path, char *port)
     /* Check if port and/or path specified */
     path_start = strpbrk(buf, "/");
     port_start = strpbrk(buf, ":");
+    /* A ':' in the path is not a port separator */
+    if (port_start && path_start && port_start > path_start)
+    	port_start = NULL;
 
     /* Path and port not specified, so use default values */
     if ((!path_start) && (!port_start)) {
@@ -388,27 +1235,38 @@ int parse_uri(char *uri, char *host, char *path, char *port)
 void clienterror(int fd, char *cause, char *errnum, 
 		 char *shortmsg, char *longmsg) 
 {
-    char buf[MAXLINE], body[MAXBUF];
+    char buf[MAXLINE];
 
-    /* Reset all used strings */
-    memset_str(buf);
-    memset_str(body);
+    build_clienterror(buf, MAXLINE, cause, errnum, shortmsg, longmsg);
+    RIOWRITEN(fd, buf, strlen(buf));
+}
+
+/*
+ * build_clienterror - build the full error response (status line, headers
+ *			and HTML body) sent by clienterror into out, truncating it
+ *			to n bytes. Returns the length of the response.
+ */
+int build_clienterror(char *out, size_t n, char *cause, char *errnum,
+					  char *shortmsg, char *longmsg)
+{
+    char body[MAXBUF];
+    int len;
 
     /* Build the HTTP response body */
-    sprintf(body, "<html><title>Proxy Error</title>");
-    sprintf(body, "%s<body bgcolor=""ffffff"">\r\n", body);
-    sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-    sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-    sprintf(body, "%s<hr><em>The Proxy Web Server</em>\r\n", body);
-
-    /* Print the HTTP response */
-    sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-    RIOWRITEN(fd, buf, strlen(buf));
-    sprintf(buf, "Content-type: text/html\r\n");
-    RIOWRITEN(fd, buf, strlen(buf));
-    sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-    RIOWRITEN(fd, buf, strlen(buf));
-    RIOWRITEN(fd, body, strlen(body));
+    snprintf(body, MAXBUF, "<html><title>Proxy Error</title>"
+    		 "<body bgcolor=""ffffff"">\r\n"
+    		 "%s: %s\r\n"
+    		 "<p>%s: %.512s\r\n"
+    		 "<hr><em>The Proxy Web Server</em>\r\n",
+    		 errnum, shortmsg, longmsg, cause);
+
+    /* Build the HTTP response */
+    len = snprintf(out, n, "HTTP/1.0 %s %s\r\n"
+    			   "Content-type: text/html\r\n"
+    			   "Content-length: %d\r\n\r\n%s",
+    			   errnum, shortmsg, (int)strlen(body), body);
+
+    return (len < n) ? len : n - 1;
 }
 
 /***************************/
@@ -425,12 +1283,13 @@ void clienterror(int fd, char *cause, char *errnum,
  */
 ssize_t my_rio_writen(int fd, void *usrbuf, size_t n) 
 {
-	if (rio_writen(fd, usrbuf, n)) 
+	if (rio_writen(fd, usrbuf, n) < 0) 
 	{
     	if (errno == EPIPE)
      		fprintf(stderr, "Proxy handled EPIPE\n");
     	else
     		fprintf(stderr, "rio_writen error\n");
+    	return -1;
   	}
 
   	return n;
@@ -454,6 +1313,32 @@ ssize_t my_rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
   	return nread;
 } 
 
+/*
+ * my_rio_read - read up to n bytes from rp: what it has buffered, if
+ *		anything, else straight from its fd into usrbuf, with no copy
+ *		through the buffer. Returns as soon as any bytes are in.
+ */
+ssize_t my_rio_read(rio_t *rp, void *usrbuf, size_t n)
+{
+	ssize_t nread;
+
+	if (rp->rio_cnt > 0)
+		return my_rio_readnb(rp, usrbuf,
+							 (n < (size_t)rp->rio_cnt) ? n : rp->rio_cnt);
+
+	while ((nread = read(rp->rio_fd, usrbuf, n)) < 0 && errno == EINTR)
+		;
+	if (nread < 0)
+	{
+  		if (errno == ECONNRESET)
+    		fprintf(stderr, "Proxy handled ECONNRESET\n");
+    	else
+    		fprintf(stderr, "rio_read error\n");
+	}
+
+	return nread;
+}
+
 /*
  * my_rio_readnb - network-compatible version of csapp.c's Rio_readnb
  */
@@ -477,10 +1362,729 @@ ssize_t my_rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 /*************************/
 
 
+/******************************/
+/*** KEY-BUILDING FUNCTIONS ***/
+/******************************/
+
+/*
+ * build_key - build the cache key (MAXLINE) of a request for path on
+ *		host:port. The key is "GET host:port/path?query", with the host
+ *		lowercased and the path normalized, so requests differing only
+ *		in spelling share a line. A Host header naming another host, and
+ *		the values of the -k headers found in hdrs, are appended on
+ *		lines of their own.
+ *		Returns 0 on success, -1 if the key is too long, and 1 if the
+ *		request is private: it carries credentials (Authorization) or
+ *		cookies (Cookie) that the key is not made of, so its response may
+ *		be meant for that client alone and must not be cached.
+ */
+int build_key(char *key, char *host, char *port, char *path,
+			  char *hdr_host, char *hdrs)
+{
+	int i;
+	size_t n;
+	char *p, npath[MAXLINE], value[MAXLINE], host_port[MAXLINE];
+
+	if ((has_header(hdrs, "Authorization") && !key_header("Authorization")) ||
+		(has_header(hdrs, "Cookie") && !key_header("Cookie")))
+		return 1;
+
+	n = snprintf(key, MAXLINE, "GET ");
+	for (p = host; *p && n < MAXLINE - 1; p++)
+		key[n++] = tolower(*p);
+	/* "host." names the same host as "host" */
+	if (n > 4 && key[n-1] == '.')
+		n--;
+	normalize_path(npath, path);
+	if ((n += snprintf(key + n, MAXLINE - n, ":%s%s", port, npath)) >= MAXLINE)
+		return -1;
+
+	/* The Host header picks the site on a shared server */
+	snprintf(host_port, MAXLINE, "%s:%s", host, port);
+	if (*hdr_host && strcasecmp(hdr_host, host) &&
+		strcasecmp(hdr_host, host_port))
+	{
+		if ((n += snprintf(key + n, MAXLINE - n, "\nhost: ")) >= MAXLINE)
+			return -1;
+		for (p = hdr_host; *p && n < MAXLINE - 1; p++)
+			key[n++] = tolower(*p);
+		key[n] = '\0';
+	}
+
+	for (i = 0; i < nkey_headers; i++)
+	{
+		if (find_header(hdrs, key_headers[i], value) < 0)
+			continue;
+		if ((n += snprintf(key + n, MAXLINE - n, "\n%s: %s",
+						   key_headers[i], value)) >= MAXLINE)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * key_header - Returns whether the request header called name is part of
+ *		the cache key (-k)
+ */
+int key_header(char *name)
+{
+	int i;
+
+	for (i = 0; i < nkey_headers; i++)
+		if (!strcasecmp(key_headers[i], name))
+			return 1;
+	return 0;
+}
+
+/*
+ * variant_key - build the key of the variant of an object that a request
+ *		(req) selects into out (MAXLINE), given the request headers the
+ *		object varies on (names, see http_resp_t) and its key (key, or
+ *		that of any of its variants): the object's key, VARIANT_SEP and
+ *		the names, then a line per name with its value in req ("name"
+ *		alone if absent), so requests that only differ in whitespace
+ *		share a variant. With no names, that is the object's key.
+ *		Returns 0 on success, -1 if the key is too long.
+ */
+int variant_key(char *out, cache_key_t *key, char *names, char *req)
+{
+	char name[MAX_VARY], value[MAXLINE], *p;
+	size_t len, n = key_base_len(key->str, key->len);
+
+	memcpy(out, key->str, n);
+	out[n] = '\0';
+	if (!*names)
+		return 0;
+
+	if ((n += snprintf(out + n, MAXLINE - n, VARIANT_SEP "%s", names)) >= MAXLINE)
+		return -1;
+	for (p = names; *p; p += len + (p[len] == ','))
+	{
+		len = strcspn(p, ",");
+		memcpy(name, p, len);
+		name[len] = '\0';
+		if (find_header(req, name, value) < 0)
+			n += snprintf(out + n, MAXLINE - n, "\n%s", name);
+		else {
+			normalize_list(value);
+			n += snprintf(out + n, MAXLINE - n, "\n%s: %s", name, value);
+		}
+		if (n >= MAXLINE)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * normalize_list - normalize the whitespace of a header value in place:
+ *		none around commas, and runs of it squeezed into one space
+ */
+void normalize_list(char *value)
+{
+	char *in, *out = value;
+
+	for (in = value; *in; in++)
+	{
+		if (isblank(*in) &&
+			(out == value || out[-1] == ',' || out[-1] == ' '))
+			continue;
+		if (*in == ',' && out > value && out[-1] == ' ')
+			out--;
+		*out++ = isblank(*in) ? ' ' : *in;
+	}
+	if (out > value && out[-1] == ' ')
+		out--;
+	*out = '\0';
+}
+
+/*
+ * normalize_path - normalize the path of a request URI into out
+ *		(MAXLINE): drop any fragment, decode percent-encoded unreserved
+ *		characters and uppercase the other escapes, resolve "." and ".."
+ *		segments, and drop an empty query.
+ */
+void normalize_path(char *out, char *path)
+{
+	char buf[MAXLINE], *query, *seg, *next, *o = out;
+	size_t n;
+
+	/* Fragments never reach the server */
+	n = strcspn(path, "#");
+	n = pct_normalize(buf, path, n);
+	if ((query = strchr(buf, '?')))
+		*query++ = '\0';
+
+	/* Resolve dot segments (RFC 3986, 5.2.4) one segment at a time */
+	for (seg = buf + (*buf == '/'); seg; seg = next)
+	{
+		if ((next = strchr(seg, '/')))
+			*next++ = '\0';
+		if (!strcmp(seg, "..")) {
+			/* Back up over the last segment written */
+			while (o > out && *--o != '/')
+				;
+		}
+		else if (strcmp(seg, ".")) {
+			*o++ = '/';
+			n = strlen(seg);
+			memcpy(o, seg, n);
+			o += n;
+			continue;
+		}
+		/* A final "." or ".." leaves a directory path */
+		if (!next)
+			*o++ = '/';
+	}
+	if (o == out)
+		*o++ = '/';
+	*o = '\0';
+
+	if (query && *query)
+		snprintf(o, MAXLINE - (o - out), "?%s", query);
+}
+
+/*
+ * pct_normalize - copy n bytes of in to out, decoding percent-encoded
+ *		unreserved characters (RFC 3986, 2.3) and uppercasing the hex
+ *		digits of the other escapes. out must hold n+1 bytes.
+ *		Returns the length of out.
+ */
+int pct_normalize(char *out, char *in, size_t n)
+{
+	size_t i, o = 0;
+	int c;
+
+	for (i = 0; i < n; i++)
+	{
+		if (in[i] == '%' && i + 2 < n && isxdigit(in[i+1]) &&
+			isxdigit(in[i+2]))
+		{
+			sscanf(in + i + 1, "%2x", &c);
+			if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~')
+				out[o++] = c;
+			else {
+				out[o++] = '%';
+				out[o++] = toupper(in[i+1]);
+				out[o++] = toupper(in[i+2]);
+			}
+			i += 2;
+		}
+		else
+			out[o++] = in[i];
+	}
+	out[o] = '\0';
+
+	return o;
+}
+
+/**********************************/
+/*** END KEY-BUILDING FUNCTIONS ***/
+/**********************************/
+
+
+/************************/
+/*** OPTION FUNCTIONS ***/
+/************************/
+
+/* Config file names of the command line options */
+static const struct {
+	char *name;
+	int opt;
+} config_names[] = {
+	{ "mode", 'm' },
+	{ "workers", 'w' },
+	{ "queue", 'q' },
+	{ "queue_full", 'f' },
+	{ "acceptors", 'a' },
+	{ "shards", 's' },
+	{ "cache_size", 'c' },
+	{ "object_size", 'o' },
+	{ "policy", 'p' },
+	{ "admission", 'A' },
+	{ "key_header", 'k' },
+	{ "disk_dir", 'd' },
+	{ "disk_size", 'D' },
+	{ "default_ttl", 'T' },
+	{ "stale_while_revalidate", 'W' },
+	{ "range_miss", 'R' },
+	{ "snapshot", 'S' },
+	{ NULL, 0 }
+};
+
+/*
+ * set_option - apply the command line option opt with argument arg.
+ *		Returns 0 on success, -1 if the option or its argument is invalid.
+ */
+int set_option(int opt, char *arg)
+{
+	if (opt == 'm' && !strcmp(arg, "thread"))
+		mode = MODE_THREAD;
+	else if (opt == 'm' && !strcmp(arg, "epoll"))
+		mode = MODE_EPOLL;
+	else if (opt == 'm' && !strcmp(arg, "pool"))
+		mode = MODE_POOL;
+	else if (opt == 'm' && !strcmp(arg, "uring"))
+		mode = MODE_URING;
+	else if (opt == 'w' && (nworkers = atoi(arg)) > 0)
+		return 0;
+	else if (opt == 'q' && (queue_depth = atoi(arg)) > 0)
+		return 0;
+	else if (opt == 'f' && !strcmp(arg, "block"))
+		reject_full = 0;
+	else if (opt == 'f' && !strcmp(arg, "503"))
+		reject_full = 1;
+	else if (opt == 'a' && (nacceptors = atoi(arg)) >= 0)
+		nacceptors = nacceptors ? nacceptors : sysconf(_SC_NPROCESSORS_ONLN);
+	else if (opt == 's' && (cache_conf.nshards = atoi(arg)) > 0)
+		return 0;
+	else if (opt == 'c' && (cache_conf.max_size = parse_size(arg)) > 0)
+		return 0;
+	else if (opt == 'o' && (cache_conf.max_object_size = parse_size(arg)) > 0)
+		return 0;
+	else if (opt == 'p' && (cache_conf.policy = policy_find(arg)))
+		return 0;
+	else if (opt == 'A' && !strcmp(arg, "none"))
+		cache_conf.admit = 0;
+	else if (opt == 'A' && !strcmp(arg, "tinylfu"))
+		cache_conf.admit = 1;
+	else if (opt == 'k' && nkey_headers < MAX_KEY_HEADERS)
+		key_headers[nkey_headers++] = strdup(arg);
+	else if (opt == 'd')
+		cache_conf.disk_dir = strdup(arg);
+	else if (opt == 'T' && isdigit(*arg))
+		default_ttl = atol(arg);
+	else if (opt == 'W' && isdigit(*arg))
+		default_swr = atol(arg);
+	else if (opt == 'R' && !strcmp(arg, "fill"))
+		range_fill = 1;
+	else if (opt == 'R' && !strcmp(arg, "pass"))
+		range_fill = 0;
+	else if (opt == 'S')
+		snapshot_path = strdup(arg);
+	else if (opt == 'D' && (cache_conf.disk_size = parse_size(arg)) > 0)
+		return 0;
+	else
+		return -1;
+
+	return 0;
+}
+
+/*
+ * load_config - apply the options in a config file. Each line holds an
+ *		option name from config_names and its value, as in
+ *		"cache_size = 4G"; empty lines and lines starting with '#'
+ *		are skipped.
+ *		Returns 0 on success, -1 on error.
+ */
+int load_config(char *path)
+{
+	int i, lineno = 0;
+	FILE *fp;
+	char buf[MAXLINE], name[MAXLINE], value[MAXLINE];
+
+	if (!(fp = fopen(path, "r"))) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(buf, MAXLINE, fp))
+	{
+		lineno++;
+		if (sscanf(buf, " %[^ \t\r\n=] = %s", name, value) != 2 &&
+			sscanf(buf, " %[^ \t\r\n=] %s", name, value) != 2)
+			continue;
+		if (name[0] == '#')
+			continue;
+
+		for (i = 0; config_names[i].name; i++)
+			if (!strcmp(name, config_names[i].name))
+				break;
+		if (!config_names[i].name ||
+			set_option(config_names[i].opt, value) < 0) {
+			fprintf(stderr, "%s:%d: bad option \"%s\"\n", path, lineno, name);
+			fclose(fp);
+			return -1;
+		}
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/*
+ * parse_size - parse a byte count with an optional K, M or G suffix.
+ *		Returns 0 if it is not a valid size.
+ */
+size_t parse_size(char *s)
+{
+	char *end;
+	unsigned long long n = strtoull(s, &end, 10);
+
+	switch (*end) {
+	case 'G': case 'g':
+		n <<= 10;
+		/* fall through */
+	case 'M': case 'm':
+		n <<= 10;
+		/* fall through */
+	case 'K': case 'k':
+		n <<= 10;
+		end++;
+		break;
+	}
+
+	return (*end || end == s) ? 0 : (size_t)n;
+}
+
+/****************************/
+/*** END OPTION FUNCTIONS ***/
+/****************************/
+
+
 /*********************/
 /*** MISCELLANEOUS ***/
 /*********************/
 
+/*
+ * append_object - append n bytes of data to a web object being filled
+ *		for caching under key, in segments of its shard's allocator.
+ *		Returns 0 on success; -1 if the object outgrows what the cache
+ *		(either tier) would keep, in which case it is freed.
+ */
+int append_object(obj_t *obj, cache_key_t *key, char *data, size_t n)
+{
+	return obj_append(obj, &cache_shard(cache, key->hash)->slab, data, n,
+					  cache->max_fill_size);
+}
+
+/*
+ * object_room - get room at the end of a web object being filled for
+ *		caching under key, to read into in place (then obj_commit).
+ *		Sets *room to its size. Returns where it starts, NULL if the
+ *		object is already as big as the cache would keep.
+ */
+char *object_room(obj_t *obj, cache_key_t *key, size_t *room)
+{
+	return obj_room(obj, &cache_shard(cache, key->hash)->slab,
+					cache->max_fill_size, room);
+}
+
+/*
+ * read_response - read the next part of a server's response: straight
+ *		into the web object being filled, while it may still be cached,
+ *		or else into buf (MAXLINE). Sets *data to where it went.
+ *		Returns the number of bytes read, 0 on EOF, -1 on error.
+ */
+ssize_t read_response(rio_t *rp, obj_t *obj, cache_key_t *key,
+					  int cacheable, char *buf, char **data)
+{
+	size_t room = MAXLINE;
+
+	if (!cacheable || !(*data = object_room(obj, key, &room))) {
+		*data = buf;
+		room = MAXLINE;
+	}
+	return my_rio_read(rp, *data, room);
+}
+
+/*
+ * free_object - free what is left of a web object filled for key
+ */
+void free_object(obj_t *obj, cache_key_t *key)
+{
+	obj_free(obj, &cache_shard(cache, key->hash)->slab);
+}
+
+/*
+ * response_freshness - check, once the head of a response being filled
+ *		is in, whether the cache may keep it, and until when (see
+ *		http_freshness). The head must fit in the object's first segment.
+ *		key, that of the request for it (req), is set to the key to
+ *		cache it under: if it varies on request headers, that of the
+ *		variant req selects, built in vkey (MAXLINE). The headers are
+ *		recorded for the lookups of later requests.
+ *		Returns 1 if so (setting *expires), 0 if not, -1 if the head is
+ *		not complete yet.
+ */
+int response_freshness(obj_t *obj, cache_key_t *key, char *req, char *vkey,
+					   time_t *expires)
+{
+	http_resp_t resp;
+
+	if (!obj->hd)
+		return -1;
+	if (http_parse_response(obj->hd->data, obj->hd->len, &resp) < 0)
+		return (resp.head_len || obj->hd->len == obj->hd->cap) ? 0 : -1;
+
+	if (resp.vary_all)
+		return 0;
+	set_vary(cache, key, resp.vary);
+	if (variant_key(vkey, key, resp.vary, req) < 0)
+		return 0;
+	if (strcmp(vkey, key->str))
+		cache_key(key, vkey);
+
+	return http_freshness(&resp, req, time(NULL), default_ttl, expires);
+}
+
+/*
+ * select_variant - turn the key of a request (req) for an object that is
+ *		known to vary on request headers (ckey, its string in key,
+ *		MAXLINE) into that of the variant the request selects
+ */
+void select_variant(cache_key_t *ckey, char *key, char *req)
+{
+	char names[MAX_VARY], vkey[MAXLINE];
+
+	if (cache_vary(cache, ckey, names) < 0 ||
+		variant_key(vkey, ckey, names, req) < 0)
+		return;
+	strcpy(key, vkey);
+	cache_key(ckey, key);
+}
+
+/*
+ * same_variant - Returns whether a client's request (req, under key)
+ *		selects the variant of the object that a flight it follows is
+ *		fetching, once the leader has told it (see flight_variant)
+ */
+int same_variant(flight_t *flight, cache_key_t *key, char *req)
+{
+	char names[MAX_VARY], vkey[MAXLINE];
+
+	if (!flight->variant)
+		return 1;
+	/* Not a variant key: the object stopped varying */
+	if (variant_names(flight->variant, names) < 0)
+		names[0] = '\0';
+	return !variant_key(vkey, key, names, req) &&
+		   !strcmp(vkey, flight->variant);
+}
+
+/*
+ * feed_stale - append the whole of a stale copy that the server confirmed
+ *		to a flight, for its followers
+ */
+void feed_stale(flight_t *flight, stale_t *stale)
+{
+	obj_seg_t *seg;
+
+	flight_variant(flight, flight->key.str);
+	if (!stale->line)
+		flight_append(cache, flight, NULL, stale->hit.data, stale->size);
+	else for (seg = stale->line->body.hd; seg; seg = seg->next)
+		flight_append(cache, flight, NULL, seg->data, seg->len);
+}
+
+/*
+ * conditional_request - turn the request built for the server (req,
+ *		MAXLINE) into a conditional one, revalidating obj, the stale copy
+ *		of its response.
+ *		Returns 0 on success, -1 if req was left unchanged.
+ */
+int conditional_request(char *req, char *obj, size_t len)
+{
+	http_resp_t resp;
+	char hdrs[MAXLINE];
+	size_t n, rlen = strlen(req);
+
+	if (http_parse_response(obj, len, &resp) < 0 ||
+		!(n = http_conditional(&resp, hdrs, MAXLINE)) || rlen + n >= MAXLINE)
+		return -1;
+
+	/* Insert the headers before the empty line ending the request */
+	memcpy(req + rlen - 2, hdrs, n);
+	strcpy(req + rlen - 2 + n, "\r\n");
+	return 0;
+}
+
+/*
+ * client_request - put the headers of a client request answered from
+ *		the cache (hit_hdrs) back into the request built for the server
+ *		(req, MAXLINE), to pass it on as is.
+ *		Returns 0 on success, -1 if req was left unchanged.
+ */
+int client_request(char *req, char *hit_hdrs)
+{
+	size_t n = strlen(hit_hdrs), rlen = strlen(req);
+
+	if (rlen + n >= MAXLINE)
+		return -1;
+
+	/* Insert the headers before the empty line ending the request */
+	memcpy(req + rlen - 2, hit_hdrs, n);
+	strcpy(req + rlen - 2 + n, "\r\n");
+	return 0;
+}
+
+/*
+ * not_modified_reply - build a 304 (Not Modified) reply into out
+ *		(MAXLINE) for a client revalidating its own copy (hit_hdrs, the
+ *		request's headers answered from the cache, or NULL) of a cached
+ *		object: a line's (obj), or else a disk tier object (hit). See
+ *		http_not_modified.
+ *		Returns its length; 0 if the object should be sent instead.
+ */
+size_t not_modified_reply(char *out, char *hit_hdrs, obj_t *obj,
+						  disk_hit_t *hit)
+{
+	char inm[MAXLINE], ims[MAXLINE];
+
+	if (!hit_hdrs)
+		return 0;
+	if (find_header(hit_hdrs, "If-None-Match", inm) < 0)
+		inm[0] = '\0';
+	if (find_header(hit_hdrs, "If-Modified-Since", ims) < 0)
+		ims[0] = '\0';
+
+	/* The head of a line object is all in its first segment */
+	if (obj)
+		return obj->hd ? http_not_modified(obj->hd->data, obj->hd->len,
+										   inm, ims, out, MAXLINE) : 0;
+	return http_not_modified(hit->data, hit->size, inm, ims, out, MAXLINE);
+}
+
+/*
+ * partial_reply - build the reply to a Range request (hit_hdrs, the
+ *		request's headers answered from the cache, or NULL) from a cached
+ *		object: a line's (obj), or else a disk tier object (hit). See
+ *		http_partial.
+ *		Returns 0 on success; -1 if the whole object should be sent.
+ */
+int partial_reply(http_partial_t *p, char *hit_hdrs, obj_t *obj,
+				  disk_hit_t *hit)
+{
+	char range[MAXLINE], if_range[MAXLINE];
+
+	if (!hit_hdrs || find_header(hit_hdrs, "Range", range) < 0)
+		return -1;
+	if (find_header(hit_hdrs, "If-Range", if_range) < 0)
+		if_range[0] = '\0';
+
+	/* The head of a line object is all in its first segment */
+	if (obj)
+		return obj->hd ? http_partial(p, range, if_range, obj->hd->data,
+									  obj->hd->len, obj->len) : -1;
+	return http_partial(p, range, if_range, hit->data, hit->size, hit->size);
+}
+
+/*
+ * revalidate_stale - check the head (len bytes) of the server's answer
+ *		to a conditional request (req) for a stale copy. A 304 (Not
+ *		Modified) confirms the copy: its headers update the stored
+ *		head (see http_merge), and the copy is stored again with it if
+ *		still allowed. The pin on the copy may move to the new one.
+ *		Returns 1 if the copy is confirmed, 0 if the server sent a new
+ *		response instead, -1 if the head is not complete yet.
+ */
+int revalidate_stale(cache_key_t *key, stale_t *stale, char *req, char *head,
+					 size_t len)
+{
+	http_resp_t resp, stored, updated;
+	time_t expires;
+	char *merged;
+	size_t n;
+
+	if (http_parse_response(head, len, &resp) < 0)
+		return resp.head_len ? 0 : -1;
+	if (resp.status != 304)
+		return 0;
+
+	/* Store the copy again with the head the 304 updates, if it is
+	 * still allowed by it
+	 */
+	if (!http_parse_response(stale->head, stale->head_len, &stored)) {
+		merged = Malloc(stored.head_len + resp.head_len);
+		if ((n = http_merge(stale->head, stored.head_len, head, resp.head_len,
+							merged, stored.head_len + resp.head_len)) &&
+			!http_parse_response(merged, n, &updated) &&
+			http_freshness(&updated, req, time(NULL), default_ttl, &expires))
+			refresh_stale(cache, key, stale, merged, n, stored.head_len,
+						  expires);
+		Free(merged);
+	}
+	return 1;
+}
+
+/*
+ * stale_usable - Returns whether a stale copy may be served while it is
+ *		refreshed in the background, i.e. whether it has been stale for
+ *		less than its stale-while-revalidate window
+ */
+int stale_usable(stale_t *stale)
+{
+	http_resp_t resp;
+
+	if (http_parse_response(stale->head, stale->head_len, &resp) < 0)
+		return 0;
+
+	return time(NULL) < stale->expires + http_stale_window(&resp, default_swr);
+}
+
+/*
+ * write_object - write a cached web object to fd, segment by segment.
+ *		Returns 0 on success, -1 on error.
+ */
+int write_object(int fd, obj_t *obj)
+{
+	obj_seg_t *seg;
+
+	for (seg = obj->hd; seg; seg = seg->next)
+		if (my_rio_writen(fd, seg->data, seg->len) < 0)
+			return -1;
+
+	return 0;
+}
+
+/*
+ * write_slice - write the len bytes at offset off of a cached web object
+ *		to fd, from the segments holding them.
+ *		Returns 0 on success, -1 on error.
+ */
+int write_slice(int fd, obj_t *obj, size_t off, size_t len)
+{
+	size_t n;
+	obj_seg_t *seg;
+
+	for (seg = obj->hd; seg && off >= seg->len; seg = seg->next)
+		off -= seg->len;
+
+	for (; seg && len > 0; seg = seg->next, off = 0)
+	{
+		n = (len < seg->len - off) ? len : seg->len - off;
+		if (my_rio_writen(fd, seg->data + off, n) < 0)
+			return -1;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * my_sendfile - send n bytes of in_fd, from offset off, to out_fd
+ *		without copying them through user space.
+ *		Returns n on success, -1 on error.
+ */
+ssize_t my_sendfile(int out_fd, int in_fd, off_t off, size_t n)
+{
+	ssize_t rc;
+	size_t left = n;
+
+	while (left > 0)
+	{
+		if ((rc = sendfile(out_fd, in_fd, &off, left)) <= 0) {
+			if (rc < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		left -= rc;
+	}
+
+	return n;
+}
+
 /*
  * memset_str - clear a string of its memory
  */
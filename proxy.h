@@ -0,0 +1,61 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * proxy.h
+ * CODE DESCRIPTION
+ *
+ * Declarations shared between proxy.c and the alternative
+ * connection-handling backends (reactor.c).
+ */
+
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#include "csapp.h"
+#include "webcache.h"
+#include "flight.h"
+#include "http.h"
+
+/* Shared web cache */
+extern cache_t *cache;
+
+/* Request-building functions */
+int req_head_complete(char *head);
+int build_request(char *head, char *req, char *key, char *host, char *port,
+				  char *hit_hdrs, char *err);
+int client_request(char *req, char *hit_hdrs);
+int has_header(char *hdrs, char *name);
+/* Cache-filling functions */
+int append_object(obj_t *obj, cache_key_t *key, char *data, size_t n);
+char *object_room(obj_t *obj, cache_key_t *key, size_t *room);
+void free_object(obj_t *obj, cache_key_t *key);
+int response_freshness(obj_t *obj, cache_key_t *key, char *req, char *vkey,
+					   time_t *expires);
+void feed_stale(flight_t *flight, stale_t *stale);
+int conditional_request(char *req, char *obj, size_t len);
+int revalidate_stale(cache_key_t *key, stale_t *stale, char *req, char *head,
+					 size_t len);
+int stale_usable(stale_t *stale);
+void start_refresh(cache_key_t *key, char *req, char *host, char *port,
+				   flight_t *flight);
+void fill_for_range(cache_key_t *key, char *req, char *host, char *port);
+/* Variant functions */
+void select_variant(cache_key_t *ckey, char *key, char *req);
+int same_variant(flight_t *flight, cache_key_t *key, char *req);
+/* Hit-answering functions */
+size_t not_modified_reply(char *out, char *hit_hdrs, obj_t *obj,
+						  disk_hit_t *hit);
+int partial_reply(http_partial_t *p, char *hit_hdrs, obj_t *obj,
+				  disk_hit_t *hit);
+/* Error-building functions */
+int build_clienterror(char *out, size_t n, char *cause, char *errnum,
+					  char *shortmsg, char *longmsg);
+
+#endif /* __PROXY_H__ */
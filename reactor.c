@@ -0,0 +1,1197 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * reactor.c
+ * CODE DESCRIPTION
+ *
+ * An edge-triggered epoll event loop that serves every client accepted
+ * on one listening fd from a single thread, as an alternative to the
+ * thread-per-client loop in proxy.c (with -a, one loop per listener).
+ * Client and server sockets are non-blocking, and each connection is
+ * driven through a state machine covering the same phases as
+ * process_client_request:
+ *
+ *   ST_READ_REQ    read request line and headers, then look up the cache
+ *   ST_CONNECT     connect to the server on a miss
+ *   ST_SEND_REQ    forward the built request
+ *   ST_RELAY_READ  read the next chunk of the server's response, straight
+ *                  into the cache object while it may still be cached
+ *   ST_RELAY_WRITE write it back to the client from there
+ *   ST_REPLY       write a cached object or error page to the client
+ *   ST_FOLLOW_WAIT wait for a fetch led by another client (flight.c)
+ *   ST_FOLLOW_WRITE write what it fetched so far to the client
+ *   ST_FILL_WAIT   wait for the followers of a fetch this connection
+ *                  leads to catch up, before reading on (flight_room)
+ *
+ * Every state names exactly one pending I/O operation (conn_op), and
+ * conn_complete consumes its result and moves on to the next state.
+ * Operations are carried out by one of two backends:
+ *
+ *   epoll     conn_drive issues the operation as a non-blocking system
+ *             call until it would block, then waits for the next edge.
+ *   io_uring  conn_submit queues it as an SQE; everything queued while
+ *             handling a batch of completions is submitted with a single
+ *             io_uring_enter call, along with the wait for the next batch.
+ *             Falls back to epoll when io_uring is unavailable.
+ *
+ * Background refreshes of stale objects (stale-while-revalidate) are
+ * queued for the refresher threads (start_refresh in proxy.c), so the
+ * loop only ever serves the stale copy.
+ *
+ * Followers of another client's fetch cannot block on it, so each one
+ * waits on an eventfd that the leader writes to whenever the response
+ * grows or ends, which fits the same one-operation-per-state scheme.
+ *
+ * Known limitation: server names are resolved with a blocking
+ * getaddrinfo call on the event loop thread.
+ */
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "csapp.h"
+#include "webcache.h"
+#include "proxy.h"
+#include "flight.h"
+#include "reactor.h"
+#include "uring.h"
+
+/* Max events handled per epoll_wait call */
+#define MAX_EVENTS 256
+
+/* io_uring SQ ring size, and accepts kept in flight on the listening fd */
+#define URING_ENTRIES 4096
+#define URING_ACCEPTS 16
+
+/* Connection states */
+typedef enum {
+	ST_READ_REQ,
+	ST_CONNECT,
+	ST_SEND_REQ,
+	ST_RELAY_READ,
+	ST_RELAY_WRITE,
+	ST_REPLY,
+	ST_FOLLOW_WAIT,
+	ST_FOLLOW_WRITE,
+	ST_FILL_WAIT,
+	ST_DONE
+} conn_state_t;
+
+/* I/O operations a connection can be waiting on */
+typedef enum {
+	OP_RECV,
+	OP_SEND,
+	OP_READ,
+	OP_CONNECT
+} conn_op_t;
+
+/* Connection structure */
+typedef struct Conn {
+	conn_state_t state;
+	conn_op_t op;		// Pending I/O operation...
+	int op_fd;			// ... on this fd
+	char *op_buf;		// ... into/from this buffer
+	size_t op_len;		// ... of this many bytes
+	int cp_fd;			// Client/proxy fd
+	int ps_fd;			// Proxy/server fd
+	struct addrinfo *ai_list, *ai; // Server addresses, and the one tried
+	char *req;			// Request forwarded to the server
+	char *host, *port;	// Server, kept by followers and revalidating leaders
+	size_t plain_len;	// Length of req without its validators, if these
+	cache_key_t key;	// Its cache key, the string on the heap
+	size_t req_len, req_off;
+	char *out;			// Data being written back to the client
+	size_t out_len, out_off;
+	line_t *line;		// Pinned cache line being written on a hit
+	obj_t *src;			// Line object being written, if any...
+	char *flat;			// ... or else disk tier object, in its mapping
+	obj_seg_t *seg;		// Next segment of src to write...
+	size_t seg_off;		// ... from this offset in it...
+	size_t seg_left;	// ... up to this many bytes in all
+	http_partial_t *part; // Reply to a Range request, if any...
+	int part_i;			// ... and its next piece to write
+	disk_hit_t hit;		// Pinned disk tier object, likewise
+	stale_t stale;		// Stale copy being revalidated, if any...
+	char *hit_hdrs;		// ... and the request headers it answers
+	obj_t obj;			// Web object being cached
+	int cacheable;		// Whether obj still fits in a cache line
+	int head;			// Whether the head of the response is in
+	time_t expires;		// When obj goes stale, if cacheable
+	flight_t *flight;	// Fetch shared with other clients, if any...
+	int leader;			// ... made by this connection
+	flight_pos_t pos;	// Position of a follower in the response
+	int wake_fd;		// eventfd to wait on a flight's progress, or -1
+	uint64_t wake;		// Its counter
+	int client_gone;	// Whether a leader's client went away
+	size_t buf_len;
+	char buf[MAXBUF];	// Request head, then relay buffer
+	struct Conn *next;	// Next closed connection awaiting free
+} conn_t;
+
+/* Event loop structure */
+typedef struct Reactor {
+	int epfd;			// epoll instance (epoll backend)
+	uring_t *ring;		// io_uring instance (io_uring backend), or NULL
+	int listenfd;		// Proxy listening fd
+	conn_t *closed;		// Connections closed during the current batch
+} reactor_t;
+
+/* Event loop functions */
+static void epoll_loop(reactor_t *r);
+static void uring_loop(reactor_t *r);
+static void reactor_add(reactor_t *r, int fd, conn_t *c);
+static void reactor_accept(reactor_t *r);
+static void reactor_free_closed(reactor_t *r);
+static void uring_accept(reactor_t *r);
+static conn_t *conn_new(int fd);
+static void set_nonblocking(int fd);
+/* Connection functions */
+static void conn_drive(reactor_t *r, conn_t *c);
+static void conn_submit(reactor_t *r, conn_t *c);
+static void conn_complete(reactor_t *r, conn_t *c, ssize_t rc);
+static void conn_start_request(reactor_t *r, conn_t *c);
+static void conn_fetch(reactor_t *r, conn_t *c, char *req, char *host,
+					   char *port);
+static void conn_connect_next(reactor_t *r, conn_t *c);
+static void conn_relay_recv(reactor_t *r, conn_t *c);
+static void conn_fill(conn_t *c, char *data, size_t n);
+static size_t conn_revalidate(reactor_t *r, conn_t *c, ssize_t n);
+static void conn_refetch(reactor_t *r, conn_t *c);
+static void conn_follow(reactor_t *r, conn_t *c);
+static void conn_pass(reactor_t *r, conn_t *c);
+static void conn_watch(reactor_t *r, conn_t *c);
+static void conn_finish(conn_t *c, int ok);
+static void conn_op(conn_t *c, conn_op_t op, int fd, char *buf, size_t len);
+static void conn_reply(conn_t *c, char *data, size_t len);
+static void conn_reply_hit(conn_t *c, char *hit_hdrs, obj_t *obj,
+						   disk_hit_t *hit);
+static void conn_reply_range(conn_t *c, size_t off, size_t len);
+static void conn_reply_next(conn_t *c);
+static void conn_reply_stale(conn_t *c);
+static void conn_error(conn_t *c, char *cause, char *errnum,
+					   char *shortmsg, char *longmsg);
+static void conn_close(reactor_t *r, conn_t *c);
+
+
+/****************************/
+/*** EVENT LOOP FUNCTIONS ***/
+/****************************/
+
+/*
+ * reactor_run - run the event loop on the listening fd forever, on the
+ *		io_uring backend if requested and available, otherwise on epoll
+ */
+void reactor_run(int listenfd, int use_uring)
+{
+	reactor_t r;
+	uring_t ring;
+
+	r.listenfd = listenfd;
+	r.closed = NULL;
+	r.ring = NULL;
+
+	if (use_uring) {
+		if (uring_init(&ring, URING_ENTRIES) == 0) {
+			r.ring = &ring;
+			uring_loop(&r);
+		}
+		fprintf(stderr, "io_uring unavailable (%s), using epoll\n",
+				strerror(errno));
+	}
+
+	epoll_loop(&r);
+}
+
+/*
+ * epoll_loop - wait for edges on the connections' fds and drive them
+ */
+static void epoll_loop(reactor_t *r)
+{
+	int i, n;
+	struct epoll_event ev, events[MAX_EVENTS];
+
+	if ((r->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		unix_error("epoll_create1 error");
+
+	/* The listening fd is the only one registered without a connection */
+	set_nonblocking(r->listenfd);
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->listenfd, &ev) < 0)
+		unix_error("epoll_ctl error");
+
+	while (1)
+	{
+		if ((n = epoll_wait(r->epfd, events, MAX_EVENTS, -1)) < 0) {
+			if (errno == EINTR)
+				continue;
+			unix_error("epoll_wait error");
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			if (events[i].data.ptr)
+				conn_drive(r, events[i].data.ptr);
+			else
+				reactor_accept(r);
+		}
+
+		reactor_free_closed(r);
+	}
+}
+
+/*
+ * uring_loop - submit the queued operations, then hand every completion
+ *		to its connection (or accept) and queue what follows. Each
+ *		connection has at most one operation in flight, so a
+ *		completion is never stale.
+ */
+static void uring_loop(reactor_t *r)
+{
+	int i;
+	conn_t *c;
+	struct io_uring_cqe *cqe;
+
+	for (i = 0; i < URING_ACCEPTS; i++)
+		uring_accept(r);
+
+	while (1)
+	{
+		if (uring_enter(r->ring, 1) < 0)
+			unix_error("io_uring_enter error");
+
+		while ((cqe = uring_peek_cqe(r->ring)))
+		{
+			c = (conn_t *)cqe->user_data;
+			/* Accept completed: start reading the request */
+			if (!c) {
+				if (cqe->res >= 0) {
+					c = conn_new(cqe->res);
+					conn_submit(r, c);
+				}
+				else if (cqe->res != -EINTR && cqe->res != -EAGAIN)
+					fprintf(stderr, "accept error: %s\n",
+							strerror(-cqe->res));
+				uring_accept(r);
+			}
+			else {
+				conn_complete(r, c, cqe->res);
+				if (c->state == ST_DONE)
+					conn_close(r, c);
+				else
+					conn_submit(r, c);
+			}
+			uring_cqe_seen(r->ring);
+		}
+
+		reactor_free_closed(r);
+	}
+}
+
+/*
+ * reactor_accept - accept every pending client and start reading
+ *		its request (epoll backend)
+ */
+static void reactor_accept(reactor_t *r)
+{
+	int fd;
+	conn_t *c;
+
+	while ((fd = accept(r->listenfd, NULL, NULL)) >= 0)
+	{
+		set_nonblocking(fd);
+		c = conn_new(fd);
+		reactor_add(r, fd, c);
+		conn_drive(r, c);
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		fprintf(stderr, "accept error: %s\n", strerror(errno));
+}
+
+/*
+ * uring_accept - queue an accept on the listening fd (io_uring backend)
+ */
+static void uring_accept(reactor_t *r)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(r->ring);
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = r->listenfd;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = 0;
+}
+
+/*
+ * reactor_free_closed - free the connections closed during the last
+ *		batch, once no event or completion can refer to them
+ */
+static void reactor_free_closed(reactor_t *r)
+{
+	conn_t *c;
+
+	while ((c = r->closed))
+	{
+		r->closed = c->next;
+		Free(c);
+	}
+}
+
+/*
+ * reactor_add - watch fd for both directions on behalf of a connection.
+ *		Any event on either of a connection's fds just retries its
+ *		pending operation, so one registration per fd is enough.
+ */
+static void reactor_add(reactor_t *r, int fd, conn_t *c)
+{
+	struct epoll_event ev;
+
+	/* The io_uring backend needs no registration */
+	if (r->ring)
+		return;
+
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = c;
+	if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		unix_error("epoll_ctl error");
+}
+
+/*
+ * conn_new - create a connection for an accepted client, waiting to
+ *		read its request
+ */
+static conn_t *conn_new(int fd)
+{
+	conn_t *c = (conn_t *)Calloc(1, sizeof(conn_t));
+
+	c->cp_fd = fd;
+	c->ps_fd = -1;
+	c->wake_fd = -1;
+	c->state = ST_READ_REQ;
+	conn_op(c, OP_RECV, fd, c->buf, MAXBUF - 1);
+
+	return c;
+}
+
+/*
+ * set_nonblocking - put fd in non-blocking mode
+ */
+static void set_nonblocking(int fd)
+{
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL, 0)) < 0 ||
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		unix_error("fcntl error");
+}
+
+/********************************/
+/*** END EVENT LOOP FUNCTIONS ***/
+/********************************/
+
+
+/****************************/
+/*** CONNECTION FUNCTIONS ***/
+/****************************/
+
+/*
+ * conn_drive - issue the connection's pending operation until it would
+ *		block or the connection is done, then close it if done
+ *		(epoll backend)
+ */
+static void conn_drive(reactor_t *r, conn_t *c)
+{
+	ssize_t rc;
+
+	/* Closed earlier in this batch */
+	if (c->state == ST_DONE)
+		return;
+
+	while (c->state != ST_DONE)
+	{
+		switch (c->op) {
+		case OP_RECV:
+			rc = recv(c->op_fd, c->op_buf, c->op_len, 0);
+			break;
+		case OP_SEND:
+			rc = send(c->op_fd, c->op_buf, c->op_len, MSG_NOSIGNAL);
+			break;
+		case OP_READ:
+			rc = read(c->op_fd, c->op_buf, c->op_len);
+			break;
+		default: /* OP_CONNECT; repeated until it stops being in progress */
+			rc = connect(c->op_fd, c->ai->ai_addr, c->ai->ai_addrlen);
+			if (rc < 0 && errno == EISCONN)
+				rc = 0;
+			break;
+		}
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+		/* Wait for the next edge on the fd */
+		if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+					   errno == EINPROGRESS || errno == EALREADY))
+			return;
+
+		conn_complete(r, c, (rc < 0) ? -errno : rc);
+	}
+
+	conn_close(r, c);
+}
+
+/*
+ * conn_submit - queue the connection's pending operation on the ring
+ *		(io_uring backend)
+ */
+static void conn_submit(reactor_t *r, conn_t *c)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(r->ring);
+
+	sqe->fd = c->op_fd;
+	sqe->user_data = (unsigned long)c;
+	switch (c->op) {
+	case OP_RECV:
+		sqe->opcode = IORING_OP_RECV;
+		sqe->addr = (unsigned long)c->op_buf;
+		sqe->len = c->op_len;
+		break;
+	case OP_SEND:
+		sqe->opcode = IORING_OP_SEND;
+		sqe->addr = (unsigned long)c->op_buf;
+		sqe->len = c->op_len;
+		sqe->msg_flags = MSG_NOSIGNAL;
+		break;
+	case OP_READ:
+		sqe->opcode = IORING_OP_READ;
+		sqe->addr = (unsigned long)c->op_buf;
+		sqe->len = c->op_len;
+		break;
+	default: /* OP_CONNECT */
+		sqe->opcode = IORING_OP_CONNECT;
+		sqe->addr = (unsigned long)c->ai->ai_addr;
+		sqe->off = c->ai->ai_addrlen;
+		break;
+	}
+}
+
+/*
+ * conn_complete - consume the result of the pending operation (bytes
+ *		transferred, or -errno) and set up the next one
+ */
+static void conn_complete(reactor_t *r, conn_t *c, ssize_t rc)
+{
+	char *data;
+
+	switch (c->state) {
+	case ST_READ_REQ:
+		if (rc <= 0) {
+			c->state = ST_DONE;
+			break;
+		}
+		c->buf_len += rc;
+		c->buf[c->buf_len] = '\0';
+		if (req_head_complete(c->buf))
+			conn_start_request(r, c);
+		else if (c->buf_len == MAXBUF - 1)
+			conn_error(c, "request", "400", "Bad request",
+					   "Request is too long");
+		else
+			conn_op(c, OP_RECV, c->cp_fd, c->buf + c->buf_len,
+					MAXBUF - 1 - c->buf_len);
+		break;
+
+	case ST_CONNECT:
+		/* Connect failed: try the server's next address */
+		if (rc < 0) {
+			Close(c->ps_fd);
+			c->ps_fd = -1;
+			c->ai = c->ai->ai_next;
+			conn_connect_next(r, c);
+			break;
+		}
+		freeaddrinfo(c->ai_list);
+		c->ai_list = c->ai = NULL;
+		c->state = ST_SEND_REQ;
+		conn_op(c, OP_SEND, c->ps_fd, c->req, c->req_len);
+		break;
+
+	case ST_SEND_REQ:
+		if (rc < 0) {
+			c->state = ST_DONE;
+			break;
+		}
+		c->req_off += rc;
+		if (c->req_off < c->req_len) {
+			conn_op(c, OP_SEND, c->ps_fd, c->req + c->req_off,
+					c->req_len - c->req_off);
+			break;
+		}
+		conn_relay_recv(r, c);
+		break;
+
+	case ST_RELAY_READ:
+		data = c->op_buf;
+		/* If revalidating, hold the response back until its head tells
+		 * whether the stale copy is still good
+		 */
+		if (c->stale.head) {
+			if (!(rc = conn_revalidate(r, c, rc)))
+				break;
+			data = c->buf;
+		}
+		/* Add the web object to the cache once relayed in full, then
+		 * let the followers finish
+		 */
+		if (rc == 0 && c->cacheable && c->expires)
+			add_object(cache, &c->key, &c->obj, c->expires); //// CACHE WRITE ////
+		if (rc <= 0) {
+			if (c->flight)
+				conn_finish(c, rc == 0 && !c->stale.head);
+			c->state = ST_DONE;
+			break;
+		}
+		conn_fill(c, data, rc);
+		/* Only the followers are left to feed */
+		if (c->client_gone) {
+			conn_relay_recv(r, c);
+			break;
+		}
+		c->state = ST_RELAY_WRITE;
+		c->out = data;
+		c->out_len = rc;
+		c->out_off = 0;
+		conn_op(c, OP_SEND, c->cp_fd, c->out, c->out_len);
+		break;
+
+	case ST_RELAY_WRITE:
+	case ST_REPLY:
+	case ST_FOLLOW_WRITE:
+		/* A leader whose client went away still fetches for followers */
+		if (rc < 0 && c->state == ST_RELAY_WRITE && c->flight &&
+			flight_followers(c->flight)) {
+			c->client_gone = 1;
+			c->out_off = c->out_len;
+		}
+		else if (rc < 0) {
+			c->state = ST_DONE;
+			break;
+		}
+		else
+			c->out_off += rc;
+		if (c->out_off < c->out_len)
+			conn_op(c, OP_SEND, c->cp_fd, c->out + c->out_off,
+					c->out_len - c->out_off);
+		/* Objects from a cache line go out one segment at a time, and
+		 * replies to Range requests one range at a time
+		 */
+		else if (c->state == ST_REPLY)
+			conn_reply_next(c);
+		else if (c->state == ST_FOLLOW_WRITE)
+			conn_follow(r, c);
+		else
+			conn_relay_recv(r, c);
+		break;
+
+	case ST_FOLLOW_WAIT:
+		if (rc < 0) {
+			c->state = ST_DONE;
+			break;
+		}
+		conn_follow(r, c);
+		break;
+
+	case ST_FILL_WAIT:
+		if (rc < 0) {
+			c->state = ST_DONE;
+			break;
+		}
+		conn_relay_recv(r, c);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/*
+ * conn_start_request - parse the complete request head in the buffer,
+ *		then either reply from the cache or start connecting to the server
+ */
+static void conn_start_request(reactor_t *r, conn_t *c)
+{
+	flight_t *flight;
+	int leader;
+	char req[MAXLINE], key[MAXLINE], host[MAXLINE], port[MAXLINE];
+	char hit_hdrs[MAXLINE], err[MAXLINE];
+
+	if (build_request(c->buf, req, key, host, port, hit_hdrs, err) < 0) {
+		c->buf_len = strlen(err);
+		memcpy(c->buf, err, c->buf_len);
+		conn_reply(c, c->buf, c->buf_len);
+		return;
+	}
+
+	/* A private request (no key) is passed on as is, and its response
+	 * relayed without being cached
+	 */
+	if (!*key) {
+		client_request(req, hit_hdrs);
+		conn_fetch(r, c, req, host, port);
+		return;
+	}
+
+	/* Check the cache for request; replies straight from the line,
+	 * which stays pinned until the connection closes (with the ranges
+	 * asked for, if any)
+	 */
+	cache_key(&c->key, key);
+	select_variant(&c->key, key, req);
+	if ((c->line = in_cache(cache, &c->key))) { //// CACHE READ ////
+		c->key.str = NULL;
+		conn_reply_hit(c, hit_hdrs, &c->line->body, NULL);
+		return;
+	}
+	if (!in_disk(cache, &c->key, &c->hit)) { //// DISK READ ////
+		c->key.str = NULL;
+		conn_reply_hit(c, hit_hdrs, NULL, &c->hit);
+		return;
+	}
+
+	/* Or from a copy stale for less than its stale-while-revalidate
+	 * window, which one background fetch refreshes meanwhile
+	 */
+	if (!find_stale(cache, &c->key, &c->stale) && stale_usable(&c->stale)) {
+		flight = flight_join(cache, &c->key, &leader);
+		if (leader)
+			start_refresh(&c->key, req, host, port, flight);
+		else
+			flight_release(flight);
+		c->key.str = NULL;
+		conn_reply_hit(c, hit_hdrs, c->stale.line ? &c->stale.line->body : NULL,
+					   &c->stale.hit);
+		return;
+	}
+
+	/* A Range request that misses is passed on to the server as is,
+	 * and relayed without being cached, while the whole object may be
+	 * fetched for the cache; so is a conditional one with no stale copy
+	 * to answer it from
+	 */
+	if (has_header(hit_hdrs, "Range") || (*hit_hdrs && !c->stale.head)) {
+		release_stale(&c->stale);
+		if (has_header(hit_hdrs, "Range"))
+			fill_for_range(&c->key, req, host, port);
+		client_request(req, hit_hdrs);
+	}
+	else {
+		/* Follow the fetch another client is making for it, if any */
+		c->flight = flight_join(cache, &c->key, &c->leader);
+		if (!c->leader) {
+			release_stale(&c->stale);
+			/* Keep what it takes to pass the request on as is, should
+			 * the response be another variant of the object, or not to
+			 * be shared
+			 */
+			c->req = (char *)Malloc(strlen(req) + 1);
+			strcpy(c->req, req);
+			c->key.str = (char *)Malloc(c->key.len + 1);
+			strcpy(c->key.str, key);
+			c->host = (char *)Malloc(strlen(host) + 1);
+			strcpy(c->host, host);
+			c->port = (char *)Malloc(strlen(port) + 1);
+			strcpy(c->port, port);
+			if (*hit_hdrs) {
+				c->hit_hdrs = (char *)Malloc(strlen(hit_hdrs) + 1);
+				strcpy(c->hit_hdrs, hit_hdrs);
+			}
+			conn_follow(r, c);
+			return;
+		}
+
+		/* Revalidate a stale copy, if there is one, instead of
+		 * fetching the object again
+		 */
+		c->plain_len = strlen(req);
+		if ((c->stale.head || !find_stale(cache, &c->key, &c->stale)) &&
+			conditional_request(req, c->stale.head, c->stale.head_len) < 0)
+			release_stale(&c->stale);
+		else if (c->stale.head) {
+			/* Keep what it takes to fetch it again unconditionally,
+			 * should the answer not do (see conn_refetch)
+			 */
+			c->host = (char *)Malloc(strlen(host) + 1);
+			strcpy(c->host, host);
+			c->port = (char *)Malloc(strlen(port) + 1);
+			strcpy(c->port, port);
+			if (*hit_hdrs) {
+				c->hit_hdrs = (char *)Malloc(strlen(hit_hdrs) + 1);
+				strcpy(c->hit_hdrs, hit_hdrs);
+			}
+		}
+	}
+	c->key.str = (char *)Malloc(c->key.len + 1);
+	strcpy(c->key.str, key);
+	conn_fetch(r, c, req, host, port);
+}
+
+/*
+ * conn_fetch - start forwarding the request built for the server (req)
+ *		to host:port, saving it on the connection
+ */
+static void conn_fetch(reactor_t *r, conn_t *c, char *req, char *host,
+					   char *port)
+{
+	struct addrinfo hints;
+
+	c->buf_len = 0;
+	c->req_len = strlen(req);
+	c->req = (char *)Malloc(c->req_len + 1);
+	strcpy(c->req, req);
+
+	/* Get a list of potential server addresses */
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+	if (getaddrinfo(host, port, &hints, &c->ai_list) != 0) {
+		c->ai_list = NULL;
+		conn_error(c, "request_line", "400", "Bad request",
+				   "Proxy could not understand the request");
+		return;
+	}
+
+	c->ai = c->ai_list;
+	c->cacheable = c->leader;
+	conn_connect_next(r, c);
+}
+
+/*
+ * conn_connect_next - start a non-blocking connect to the first server
+ *		address left to try, replying with an error if none is left
+ */
+static void conn_connect_next(reactor_t *r, conn_t *c)
+{
+	for (; c->ai; c->ai = c->ai->ai_next)
+	{
+		if ((c->ps_fd = socket(c->ai->ai_family,
+							   c->ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+							   c->ai->ai_protocol)) < 0)
+			continue;
+		reactor_add(r, c->ps_fd, c);
+		c->state = ST_CONNECT;
+		conn_op(c, OP_CONNECT, c->ps_fd, NULL, 0);
+		return;
+	}
+
+	/* All connects failed */
+	freeaddrinfo(c->ai_list);
+	c->ai_list = NULL;
+	conn_error(c, "request_line", "400", "Bad request",
+			   "Proxy could not understand the request");
+}
+
+/*
+ * conn_relay_recv - wait for the next part of the server's response:
+ *		straight into the web object being cached, while it may still
+ *		be, or else into the buffer. Waits first for the followers, if
+ *		any, to read what the flight cannot keep more of.
+ */
+static void conn_relay_recv(reactor_t *r, conn_t *c)
+{
+	char *room;
+	size_t len;
+
+	while (c->flight && !flight_room(cache, c->flight, 0))
+	{
+		if (c->wake_fd >= 0) {
+			c->state = ST_FILL_WAIT;
+			conn_op(c, OP_READ, c->wake_fd, (char *)&c->wake, sizeof(c->wake));
+			return;
+		}
+		/* Check again once watching, not to miss progress meanwhile */
+		conn_watch(r, c);
+	}
+
+	c->state = ST_RELAY_READ;
+	if (c->cacheable && !c->stale.head &&
+		(room = object_room(&c->obj, &c->key, &len)))
+		conn_op(c, OP_RECV, c->ps_fd, room, len);
+	else
+		conn_op(c, OP_RECV, c->ps_fd, c->buf, MAXBUF);
+}
+
+/*
+ * conn_fill - take the n bytes of data just read into the web object
+ *		being cached (as they are if read straight into it), giving up
+ *		once it outgrows a cache line or its head rules caching out, and
+ *		append them to the flight feeding the followers
+ */
+static void conn_fill(conn_t *c, char *data, size_t n)
+{
+	int rv;
+	char *key = c->key.str, vkey[MAXLINE];
+
+	if (c->cacheable && data != c->buf)
+		obj_commit(&c->obj, n);
+	else if (c->cacheable)
+		c->cacheable = !append_object(&c->obj, &c->key, data, n);
+	if (c->flight)
+		flight_append(cache, c->flight, c->cacheable ? &c->obj : NULL,
+					  data, n);
+
+	/* Once the head is in, stop filling if the response rules caching
+	 * out, and tell the followers which variant it is (see fetch_object)
+	 */
+	if (!c->head && (rv = c->cacheable ? response_freshness(&c->obj,
+							&c->key, c->req, vkey, &c->expires) : 0) >= 0) {
+		c->cacheable = rv;
+		c->head = 1;
+		if (c->key.str != key) {
+			Free(key);
+			c->key.str = (char *)Malloc(strlen(vkey) + 1);
+			strcpy(c->key.str, vkey);
+		}
+		if (c->flight)
+			flight_variant(c->flight, rv ? c->key.str : NULL);
+	}
+}
+
+/*
+ * conn_revalidate - take in the n bytes just read of the server's answer
+ *		to a conditional request (0 at its end, < 0 on error). Once its
+ *		head is in, either reply with the stale copy, if the server
+ *		confirmed it, or let the buffered response be relayed as usual;
+ *		a head longer than the buffer, or cut short, is not relayed but
+ *		asked for again without the validators (see fetch_object).
+ *		Returns the number of bytes to relay from the buffer, 0 if none
+ */
+static size_t conn_revalidate(reactor_t *r, conn_t *c, ssize_t n)
+{
+	int rv = -1;
+
+	if (n > 0) {
+		c->buf_len += n;
+		rv = revalidate_stale(&c->key, &c->stale, c->req, c->buf, c->buf_len);
+	}
+
+	/* Head not all in yet */
+	if (rv < 0 && n > 0 && c->buf_len < MAXBUF) {
+		conn_op(c, OP_RECV, c->ps_fd, c->buf + c->buf_len,
+				MAXBUF - c->buf_len);
+		return 0;
+	}
+	if (rv > 0) {
+		feed_stale(c->flight, &c->stale);
+		conn_finish(c, 1);
+		conn_reply_stale(c);
+		return 0;
+	}
+	if (rv < 0) {
+		conn_refetch(r, c);
+		return 0;
+	}
+
+	release_stale(&c->stale);
+	n = c->buf_len;
+	c->buf_len = 0;
+	return n;
+}
+
+/*
+ * conn_refetch - give up revalidating the stale copy, and fetch the
+ *		object again with the request stripped of its validators
+ */
+static void conn_refetch(reactor_t *r, conn_t *c)
+{
+	char req[MAXLINE];
+
+	release_stale(&c->stale);
+	Close(c->ps_fd);
+	c->ps_fd = -1;
+	strcpy(req, c->req);
+	Free(c->req);
+	strcpy(req + c->plain_len - 2, "\r\n");
+	conn_fetch(r, c, req, c->host, c->port);
+}
+
+/*
+ * conn_follow - write the next part of the response of the fetch being
+ *		followed to the client, or wait for it on the connection's
+ *		eventfd, registered with the flight on the first wait
+ */
+static void conn_follow(reactor_t *r, conn_t *c)
+{
+	char *data;
+	ssize_t n;
+
+	while ((n = flight_read(c->flight, &c->pos, &data, 0)) == FLIGHT_AGAIN)
+	{
+		if (c->wake_fd >= 0) {
+			c->state = ST_FOLLOW_WAIT;
+			conn_op(c, OP_READ, c->wake_fd, (char *)&c->wake, sizeof(c->wake));
+			return;
+		}
+		/* Check again once watching, not to miss progress meanwhile */
+		conn_watch(r, c);
+	}
+
+	/* The leader has told which variant the response is by now, or
+	 * that it is not to be shared
+	 */
+	if ((n > 0 && c->pos.read == (size_t)n &&
+		 !same_variant(c->flight, &c->key, c->req)) || n == FLIGHT_PASS)
+		conn_pass(r, c);
+	else if (n > 0) {
+		c->state = ST_FOLLOW_WRITE;
+		c->out = data;
+		c->out_len = n;
+		c->out_off = 0;
+		conn_op(c, OP_SEND, c->cp_fd, data, n);
+	}
+	/* The leader could not reach the server */
+	else if (n < 0 && !c->pos.read)
+		conn_error(c, "request_line", "400", "Bad request",
+				   "Proxy could not understand the request");
+	else
+		c->state = ST_DONE;
+}
+
+/*
+ * conn_pass - stop following a fetch whose response is another variant
+ *		of the object than the client asked for, or not to be shared, and
+ *		pass its request on to the server as is instead
+ */
+static void conn_pass(reactor_t *r, conn_t *c)
+{
+	char req[MAXLINE];
+
+	if (c->wake_fd >= 0)
+		flight_unwatch(c->flight, c->wake_fd);
+	flight_unfollow(c->flight, &c->pos);
+	flight_release(c->flight);
+	c->flight = NULL;
+
+	strcpy(req, c->req);
+	Free(c->req);
+	if (c->hit_hdrs)
+		client_request(req, c->hit_hdrs);
+	conn_fetch(r, c, req, c->host, c->port);
+}
+
+/*
+ * conn_watch - open the connection's eventfd and have the flight it
+ *		leads or follows write to it on progress
+ */
+static void conn_watch(reactor_t *r, conn_t *c)
+{
+	if ((c->wake_fd = eventfd(0, EFD_CLOEXEC |
+							  (r->ring ? 0 : EFD_NONBLOCK))) < 0)
+		unix_error("eventfd error");
+	reactor_add(r, c->wake_fd, c);
+	flight_watch(c->flight, c->wake_fd);
+}
+
+/*
+ * conn_finish - end the fetch the connection leads, successful (ok) or
+ *		not (see flight_finish)
+ */
+static void conn_finish(conn_t *c, int ok)
+{
+	if (c->wake_fd >= 0)
+		flight_unwatch(c->flight, c->wake_fd);
+	flight_finish(c->flight, ok);
+	c->flight = NULL;
+}
+
+/*
+ * conn_op - set the operation the connection waits on next
+ */
+static void conn_op(conn_t *c, conn_op_t op, int fd, char *buf, size_t len)
+{
+	c->op = op;
+	c->op_fd = fd;
+	c->op_buf = buf;
+	c->op_len = len;
+}
+
+/*
+ * conn_reply - write len bytes of data back to the client, then close
+ */
+static void conn_reply(conn_t *c, char *data, size_t len)
+{
+	c->state = ST_REPLY;
+	c->out = data;
+	c->out_len = len;
+	c->out_off = 0;
+	conn_op(c, OP_SEND, c->cp_fd, data, len);
+}
+
+/*
+ * conn_reply_hit - write a cached object back to the client: a line's
+ *		(obj), or else a disk tier object (hit), from its mapping.
+ *		hit_hdrs holds the request's headers answered from the cache, or
+ *		is NULL: a client revalidating its own copy gets a 304 if it is
+ *		still good, and a Range request the ranges it asks for.
+ */
+static void conn_reply_hit(conn_t *c, char *hit_hdrs, obj_t *obj,
+						   disk_hit_t *hit)
+{
+	c->src = obj;
+	c->flat = obj ? NULL : hit->data;
+
+	/* The request is parsed already, so the buffer is free for it */
+	if ((c->buf_len = not_modified_reply(c->buf, hit_hdrs, obj, hit))) {
+		conn_reply(c, c->buf, c->buf_len);
+		return;
+	}
+
+	if (hit_hdrs && *hit_hdrs) {
+		c->part = (http_partial_t *)Malloc(sizeof(http_partial_t));
+		if (!partial_reply(c->part, hit_hdrs, obj, hit)) {
+			c->part_i = 0;
+			conn_reply_next(c);
+			return;
+		}
+		Free(c->part);
+		c->part = NULL;
+	}
+
+	if (obj)
+		conn_reply_range(c, 0, obj->len);
+	else
+		conn_reply(c, hit->data, hit->size);
+}
+
+/*
+ * conn_reply_range - write the len bytes at offset off of the cached
+ *		object being written, then carry on with the rest of the reply
+ */
+static void conn_reply_range(conn_t *c, size_t off, size_t len)
+{
+	if (c->flat) {
+		conn_reply(c, c->flat + off, len);
+		return;
+	}
+
+	for (c->seg = c->src->hd; c->seg && off >= c->seg->len;
+		 c->seg = c->seg->next)
+		off -= c->seg->len;
+	c->seg_off = off;
+	c->seg_left = len;
+	conn_reply_next(c);
+}
+
+/*
+ * conn_reply_next - write the next piece of a reply: the next segment
+ *		of the line object range being written, else the next text or
+ *		range of a reply to a Range request. Done once there is none.
+ */
+static void conn_reply_next(conn_t *c)
+{
+	size_t n;
+	int i;
+
+	if (c->seg && c->seg_left) {
+		n = c->seg->len - c->seg_off;
+		n = (n < c->seg_left) ? n : c->seg_left;
+		conn_reply(c, c->seg->data + c->seg_off, n);
+		c->seg = c->seg->next;
+		c->seg_off = 0;
+		c->seg_left -= n;
+		return;
+	}
+
+	/* Text (even pieces) and ranges (odd pieces) take turns */
+	while (c->part && c->part_i <= 2 * c->part->n)
+	{
+		i = c->part_i++;
+		if (i % 2)
+			conn_reply_range(c, c->part->off[i / 2], c->part->len[i / 2]);
+		else if (c->part->text_len[i / 2])
+			conn_reply(c, c->part->text[i / 2], c->part->text_len[i / 2]);
+		else
+			continue;
+		return;
+	}
+
+	c->state = ST_DONE;
+}
+
+/*
+ * conn_reply_stale - write the stale copy pinned by the connection back
+ *		to the client, from its line or its disk tier mapping, as the
+ *		answer to the request headers kept with it
+ */
+static void conn_reply_stale(conn_t *c)
+{
+	conn_reply_hit(c, c->hit_hdrs, c->stale.line ? &c->stale.line->body : NULL,
+				   &c->stale.hit);
+}
+
+/*
+ * conn_error - reply to the client with an error page, see clienterror
+ */
+static void conn_error(conn_t *c, char *cause, char *errnum,
+					   char *shortmsg, char *longmsg)
+{
+	c->buf_len = build_clienterror(c->buf, MAXBUF, cause, errnum,
+								   shortmsg, longmsg);
+	conn_reply(c, c->buf, c->buf_len);
+}
+
+/*
+ * conn_close - close the connection's fds and release its resources.
+ *		The structure itself is freed at the end of the event batch.
+ */
+static void conn_close(reactor_t *r, conn_t *c)
+{
+	c->state = ST_DONE;
+	Close(c->cp_fd);
+	if (c->ps_fd >= 0)
+		Close(c->ps_fd);
+	if (c->ai_list)
+		freeaddrinfo(c->ai_list);
+	if (c->req)
+		Free(c->req);
+	if (c->host) {
+		Free(c->host);
+		Free(c->port);
+	}
+	if (c->key.str)
+		Free(c->key.str);
+	if (c->obj.hd)
+		free_object(&c->obj, &c->key);
+	if (c->line)
+		release_line(c->line);
+	if (c->hit.seg)
+		disk_release(&c->hit);
+	if (c->stale.head)
+		release_stale(&c->stale);
+	if (c->part)
+		Free(c->part);
+	if (c->hit_hdrs)
+		Free(c->hit_hdrs);
+	/* A leader that gave up fails its flight */
+	if (c->flight && c->leader)
+		conn_finish(c, 0);
+	else if (c->flight) {
+		if (c->wake_fd >= 0)
+			flight_unwatch(c->flight, c->wake_fd);
+		flight_unfollow(c->flight, &c->pos);
+		flight_release(c->flight);
+	}
+	if (c->wake_fd >= 0)
+		Close(c->wake_fd);
+
+	c->next = r->closed;
+	r->closed = c;
+}
+
+/********************************/
+/*** END CONNECTION FUNCTIONS ***/
+/********************************/
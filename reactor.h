@@ -0,0 +1,23 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * reactor.h
+ * CODE DESCRIPTION
+ *
+ * Header for reactor.c
+ */
+
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+/* Event loop functions */
+void reactor_run(int listenfd, int use_uring);
+
+#endif /* __REACTOR_H__ */
@@ -0,0 +1,116 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * sbuf.c
+ * CODE DESCRIPTION
+ *
+ * A bounded producer/consumer buffer of connected fds, after CS:APP3e's
+ * sbuf package. The accepting thread inserts, pool workers remove. The
+ * background refresh queue (proxy.c) keeps slot numbers in them too.
+ */
+
+#include "csapp.h"
+#include "sbuf.h"
+
+
+/********************************/
+/*** BOUNDED BUFFER FUNCTIONS ***/
+/********************************/
+
+/*
+ * sbuf_init - create an empty, bounded, shared FIFO buffer with n slots
+ */
+void sbuf_init(sbuf_t *sp, int n)
+{
+	sp->buf = (int *)Calloc(n, sizeof(int));
+	sp->n = n;
+	sp->front = sp->rear = 0;
+	Sem_init(&sp->mutex, 0, 1);
+	Sem_init(&sp->slots, 0, n);
+	Sem_init(&sp->items, 0, 0);
+}
+
+/*
+ * sbuf_deinit - clean up buffer sp
+ */
+void sbuf_deinit(sbuf_t *sp)
+{
+	Free(sp->buf);
+}
+
+/*
+ * sbuf_insert - insert item onto the rear of shared buffer sp,
+ *		waiting for a free slot
+ */
+void sbuf_insert(sbuf_t *sp, int item)
+{
+	P(&sp->slots);
+	P(&sp->mutex);
+	sp->buf[(++sp->rear)%(sp->n)] = item;
+	V(&sp->mutex);
+	V(&sp->items);
+}
+
+/*
+ * sbuf_tryinsert - insert item onto the rear of shared buffer sp
+ *		unless it is full.
+ *		Returns 0 on success, -1 if the buffer is full
+ */
+int sbuf_tryinsert(sbuf_t *sp, int item)
+{
+	if (sem_trywait(&sp->slots) < 0)
+		return -1;
+	P(&sp->mutex);
+	sp->buf[(++sp->rear)%(sp->n)] = item;
+	V(&sp->mutex);
+	V(&sp->items);
+
+	return 0;
+}
+
+/*
+ * sbuf_tryremove - remove and return the first item from buffer sp
+ *		unless it is empty.
+ *		Returns the item, -1 if the buffer is empty
+ */
+int sbuf_tryremove(sbuf_t *sp)
+{
+	int item;
+
+	if (sem_trywait(&sp->items) < 0)
+		return -1;
+	P(&sp->mutex);
+	item = sp->buf[(++sp->front)%(sp->n)];
+	V(&sp->mutex);
+	V(&sp->slots);
+
+	return item;
+}
+
+/*
+ * sbuf_remove - remove and return the first item from buffer sp,
+ *		waiting for one to be available
+ */
+int sbuf_remove(sbuf_t *sp)
+{
+	int item;
+
+	P(&sp->items);
+	P(&sp->mutex);
+	item = sp->buf[(++sp->front)%(sp->n)];
+	V(&sp->mutex);
+	V(&sp->slots);
+
+	return item;
+}
+
+/************************************/
+/*** END BOUNDED BUFFER FUNCTIONS ***/
+/************************************/
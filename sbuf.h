@@ -0,0 +1,41 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * sbuf.h
+ * CODE DESCRIPTION
+ *
+ * Header for sbuf.c
+ */
+
+#ifndef __SBUF_H__
+#define __SBUF_H__
+
+#include "csapp.h"
+
+/* Bounded buffer of connected fds */
+typedef struct {
+	int *buf;		// Buffer array
+	int n;			// Maximum number of slots
+	int front;		// buf[(front+1)%n] is first item
+	int rear;		// buf[rear%n] is last item
+	sem_t mutex;	// Protects accesses to buf
+	sem_t slots;	// Counts available slots
+	sem_t items;	// Counts available items
+} sbuf_t;
+
+/* Bounded buffer functions */
+void sbuf_init(sbuf_t *sp, int n);
+void sbuf_deinit(sbuf_t *sp);
+void sbuf_insert(sbuf_t *sp, int item);
+int sbuf_tryinsert(sbuf_t *sp, int item);
+int sbuf_tryremove(sbuf_t *sp);
+int sbuf_remove(sbuf_t *sp);
+
+#endif /* __SBUF_H__ */
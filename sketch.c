@@ -0,0 +1,133 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * sketch.c
+ * CODE DESCRIPTION
+ *
+ * Count-min sketch used by the cache's TinyLFU admission filter. Each
+ * key hash bumps one small saturating counter in each of SKETCH_ROWS
+ * rows, and its frequency is estimated as the smallest of them. Only
+ * the smallest counters are bumped (conservative update), which keeps
+ * the estimates tighter. Once the sketch has seen SKETCH_SAMPLE
+ * additions per counter, every counter is halved, so old popularity
+ * fades away.
+ *
+ * Counters are read and written with relaxed atomics and no lock, as
+ * additions come from lookups running under a shard's read lock; a lost
+ * update only makes an estimate slightly low.
+ */
+
+#include "csapp.h"
+#include "sketch.h"
+
+/* Odd multipliers spreading a key hash over the rows */
+static const uint64_t seeds[SKETCH_ROWS] = {
+	0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+	0x165667b19e3779f9ULL, 0xff51afd7ed558ccdULL
+};
+
+/* Counter of hash in row i */
+#define COUNTER(s, i, hash) \
+	(&(s)->counters[(i) * (s)->width + (((hash) * seeds[i]) >> (s)->shift)])
+
+
+/************************/
+/*** SKETCH FUNCTIONS ***/
+/************************/
+
+/*
+ * sketch_init - set up an empty sketch sized for a shard with the given
+ *		byte budget
+ */
+void sketch_init(sketch_t *sketch, size_t max_size)
+{
+	sketch->width = SKETCH_MIN_WIDTH;
+	sketch->shift = 64 - 8;
+	while (sketch->width < max_size / SKETCH_UNIT) {
+		sketch->width *= 2;
+		sketch->shift--;
+	}
+	sketch->counters = (uint8_t *)Calloc(SKETCH_ROWS * sketch->width,
+										 sizeof(uint8_t));
+	sketch->additions = 0;
+	sketch->sample = SKETCH_SAMPLE * sketch->width;
+}
+
+/*
+ * sketch_deinit - free a sketch
+ */
+void sketch_deinit(sketch_t *sketch)
+{
+	Free(sketch->counters);
+}
+
+/*
+ * sketch_add - count one more occurrence of hash, aging the sketch
+ *		every sample additions
+ */
+void sketch_add(sketch_t *sketch, uint64_t hash)
+{
+	int i;
+	uint8_t *c;
+	unsigned min = sketch_estimate(sketch, hash);
+
+	if (min < SKETCH_MAX)
+	{
+		for (i = 0; i < SKETCH_ROWS; i++)
+		{
+			c = COUNTER(sketch, i, hash);
+			if (__atomic_load_n(c, __ATOMIC_RELAXED) == min)
+				__atomic_store_n(c, min + 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	/* Only the thread reaching the sample size ages the sketch */
+	if (__atomic_add_fetch(&sketch->additions, 1, __ATOMIC_RELAXED) ==
+		sketch->sample)
+		sketch_age(sketch);
+}
+
+/*
+ * sketch_estimate - return the estimated number of occurrences of hash,
+ *		at most SKETCH_MAX
+ */
+unsigned sketch_estimate(sketch_t *sketch, uint64_t hash)
+{
+	int i;
+	unsigned c, min = SKETCH_MAX;
+
+	for (i = 0; i < SKETCH_ROWS; i++)
+	{
+		c = __atomic_load_n(COUNTER(sketch, i, hash), __ATOMIC_RELAXED);
+		if (c < min)
+			min = c;
+	}
+
+	return min;
+}
+
+/*
+ * sketch_age - halve every counter, and the addition count
+ */
+void sketch_age(sketch_t *sketch)
+{
+	size_t i;
+	uint8_t c;
+
+	for (i = 0; i < SKETCH_ROWS * sketch->width; i++)
+		if ((c = __atomic_load_n(&sketch->counters[i], __ATOMIC_RELAXED)))
+			__atomic_store_n(&sketch->counters[i], c / 2, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&sketch->additions, sketch->sample / 2, __ATOMIC_RELAXED);
+}
+
+/****************************/
+/*** END SKETCH FUNCTIONS ***/
+/****************************/
@@ -0,0 +1,50 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * sketch.h
+ * CODE DESCRIPTION
+ *
+ * Header for sketch.c
+ */
+
+#ifndef __SKETCH_H__
+#define __SKETCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Rows of counters, and the largest count (4 bits' worth) */
+#define SKETCH_ROWS 4
+#define SKETCH_MAX 15
+
+/* Bytes of shard budget per counter, and minimum counters per row */
+#define SKETCH_UNIT 1024
+#define SKETCH_MIN_WIDTH 256
+
+/* Counts are halved after SKETCH_SAMPLE * width additions */
+#define SKETCH_SAMPLE 10
+
+/* Count-min sketch of key frequencies, with periodic aging */
+typedef struct Sketch {
+	uint8_t *counters;	// SKETCH_ROWS rows of width counters
+	size_t width;		// Counters per row, a power of 2
+	int shift;			// 64 - log2(width), to pick a counter from a hash
+	size_t additions;	// Additions since the last aging
+	size_t sample;		// Additions between agings
+} sketch_t;
+
+/* Sketch functions */
+void sketch_init(sketch_t *sketch, size_t max_size);
+void sketch_deinit(sketch_t *sketch);
+void sketch_add(sketch_t *sketch, uint64_t hash);
+unsigned sketch_estimate(sketch_t *sketch, uint64_t hash);
+void sketch_age(sketch_t *sketch);
+
+#endif /* __SKETCH_H__ */
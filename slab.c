@@ -0,0 +1,253 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * slab.c
+ * CODE DESCRIPTION
+ *
+ * Size-class slab allocator for cache lines. Memory is taken from malloc
+ * in page_size-aligned pages; each page is split into blocks of a single
+ * size class (classes grow by ~1.25x, so rounding wastes little). A
+ * block's page is found by masking its address, so frees need no lookup.
+ *
+ * Freed blocks go back on their page's free list; a page whose blocks are
+ * all free is kept as a spare for any class, and only pages beyond
+ * SLAB_SPARE_PAGES are returned to malloc. Blocks are carved from a page
+ * lazily, so pages only become resident as they fill up.
+ * Blocks bigger than max_block come straight from malloc.
+ */
+
+#include <stdint.h>
+#include "csapp.h"
+#include "slab.h"
+
+/* Offset of the first block in a page */
+#define SLAB_HDR_SIZE \
+	((sizeof(slab_page_t) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+
+static int slab_class(slab_t *slab, size_t size);
+static slab_page_t *page_new(slab_t *slab, int cls);
+static void page_link(slab_page_t **list, slab_page_t *page);
+static void page_unlink(slab_page_t **list, slab_page_t *page);
+
+
+/**********************/
+/*** SLAB FUNCTIONS ***/
+/**********************/
+
+/*
+ * slab_init - set up an empty allocator for a cache with the given
+ *		byte budget. The page size grows with the budget, so small
+ *		caches do not pin down large pages.
+ */
+void slab_init(slab_t *slab, size_t budget)
+{
+	size_t size;
+
+	memset(slab, 0, sizeof(slab_t));
+
+	slab->page_size = SLAB_MIN_PAGE;
+	while (slab->page_size < SLAB_MAX_PAGE && 16 * slab->page_size <= budget)
+		slab->page_size *= 2;
+	/* At least four blocks per page, so pages of big blocks are not
+	 * mostly empty
+	 */
+	slab->max_block = (slab->page_size - SLAB_HDR_SIZE) / 4 &
+					  ~(size_t)(SLAB_ALIGN - 1);
+
+	for (size = SLAB_MIN_BLOCK; size < slab->max_block &&
+		 slab->nclasses < SLAB_MAX_CLASSES - 1;
+		 size = (size + size / 4 + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+		slab->sizes[slab->nclasses++] = size;
+	slab->sizes[slab->nclasses++] = slab->max_block;
+
+	pthread_mutex_init(&slab->lock, NULL);
+}
+
+/*
+ * slab_deinit - give every page back to malloc. All blocks must have
+ *		been freed.
+ */
+void slab_deinit(slab_t *slab)
+{
+	slab_page_t *page;
+
+	while ((page = slab->spare))
+	{
+		page_unlink(&slab->spare, page);
+		free(page);
+	}
+	pthread_mutex_destroy(&slab->lock);
+}
+
+/*
+ * slab_alloc - return a block of at least size bytes
+ */
+void* slab_alloc(slab_t *slab, size_t size)
+{
+	int cls;
+	void *ptr;
+	slab_page_t *page;
+
+	if (size > slab->max_block)
+		return Malloc(size);
+	cls = slab_class(slab, size);
+
+	pthread_mutex_lock(&slab->lock);
+	if (!(page = slab->partial[cls]))
+		page = page_new(slab, cls);
+
+	/* Reuse a freed block first, as it is more likely to be resident */
+	if ((ptr = page->free))
+		page->free = *(void **)ptr;
+	else {
+		ptr = page->bump;
+		page->bump += slab->sizes[cls];
+	}
+	page->inuse++;
+
+	/* A full page leaves the partial list until a block is freed */
+	if (!page->free && page->bump + slab->sizes[cls] > page->end)
+		page_unlink(&slab->partial[cls], page);
+	pthread_mutex_unlock(&slab->lock);
+
+	return ptr;
+}
+
+/*
+ * slab_free - free a block returned by slab_alloc for the same size
+ */
+void slab_free(slab_t *slab, void *ptr, size_t size)
+{
+	int cls;
+	slab_page_t *page;
+
+	if (size > slab->max_block) {
+		Free(ptr);
+		return;
+	}
+	page = (slab_page_t *)((uintptr_t)ptr & ~(uintptr_t)(slab->page_size - 1));
+	cls = page->cls;
+
+	pthread_mutex_lock(&slab->lock);
+	/* A full page goes back on the partial list */
+	if (!page->free && page->bump + slab->sizes[cls] > page->end)
+		page_link(&slab->partial[cls], page);
+
+	*(void **)ptr = page->free;
+	page->free = ptr;
+
+	/* An empty page becomes a spare, or goes back to malloc */
+	if (!--page->inuse)
+	{
+		page_unlink(&slab->partial[cls], page);
+		if (slab->nspare < SLAB_SPARE_PAGES) {
+			page_link(&slab->spare, page);
+			slab->nspare++;
+		}
+		else {
+			free(page);
+			slab->pages--;
+		}
+	}
+	pthread_mutex_unlock(&slab->lock);
+}
+
+/*
+ * slab_class - return the smallest size class fitting size bytes
+ */
+static int slab_class(slab_t *slab, size_t size)
+{
+	int lo = 0, hi = slab->nclasses - 1, mid;
+
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (slab->sizes[mid] < size)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**************************/
+/*** END SLAB FUNCTIONS ***/
+/**************************/
+
+
+/**********************/
+/*** PAGE FUNCTIONS ***/
+/**********************/
+
+/*
+ * page_new - get a page for class cls, from the spares if there is one,
+ *		and put it on the class's partial list. Called with the lock held.
+ */
+static slab_page_t *page_new(slab_t *slab, int cls)
+{
+	int rc;
+	void *mem;
+	slab_page_t *page;
+	size_t nblocks;
+
+	if ((page = slab->spare)) {
+		page_unlink(&slab->spare, page);
+		slab->nspare--;
+	}
+	else {
+		if ((rc = posix_memalign(&mem, slab->page_size, slab->page_size))) {
+			errno = rc;
+			unix_error("posix_memalign error");
+		}
+		page = (slab_page_t *)mem;
+		slab->pages++;
+	}
+
+	nblocks = (slab->page_size - SLAB_HDR_SIZE) / slab->sizes[cls];
+	page->free = NULL;
+	page->bump = (char *)page + SLAB_HDR_SIZE;
+	page->end = page->bump + nblocks * slab->sizes[cls];
+	page->inuse = 0;
+	page->cls = cls;
+	page_link(&slab->partial[cls], page);
+
+	return page;
+}
+
+/*
+ * page_link - add a page at the front of a page list
+ */
+static void page_link(slab_page_t **list, slab_page_t *page)
+{
+	page->prev = NULL;
+	page->next = *list;
+	if (*list)
+		(*list)->prev = page;
+	*list = page;
+}
+
+/*
+ * page_unlink - take a page out of a page list
+ */
+static void page_unlink(slab_page_t **list, slab_page_t *page)
+{
+	if (page->prev)
+		page->prev->next = page->next;
+	else
+		*list = page->next;
+	if (page->next)
+		page->next->prev = page->prev;
+	page->prev = page->next = NULL;
+}
+
+/**************************/
+/*** END PAGE FUNCTIONS ***/
+/**************************/
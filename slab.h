@@ -0,0 +1,66 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * slab.h
+ * CODE DESCRIPTION
+ *
+ * Header for slab.c
+ */
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <pthread.h>
+
+/* Smallest block handed out, and block alignment */
+#define SLAB_MIN_BLOCK 64
+#define SLAB_ALIGN 16
+
+/* Bounds on the page size, picked from the budget by slab_init */
+#define SLAB_MIN_PAGE (64 * 1024)
+#define SLAB_MAX_PAGE (1024 * 1024)
+
+/* Maximum number of size classes */
+#define SLAB_MAX_CLASSES 64
+
+/* Empty pages kept for reuse before they go back to malloc */
+#define SLAB_SPARE_PAGES 4
+
+/* Page header, at the start of each (page_size-aligned) page */
+typedef struct SlabPage {
+	struct SlabPage *prev; // Neighbours in a class's partial list,
+	struct SlabPage *next; // or in the spare list
+	void *free;		  // Freed blocks, linked through their first word
+	char *bump;		  // Next never-used block
+	char *end;		  // End of the last whole block
+	unsigned inuse;	  // Blocks handed out
+	unsigned cls;	  // Size class of the blocks
+} slab_page_t;
+
+/* Slab allocator: pages split into blocks of one size class each */
+typedef struct Slab {
+	size_t page_size;	// Size and alignment of the pages
+	size_t max_block;	// Larger blocks come straight from malloc
+	int nclasses;		// Number of size classes
+	size_t sizes[SLAB_MAX_CLASSES];	// Block size of each class
+	slab_page_t *partial[SLAB_MAX_CLASSES]; // Pages with free blocks
+	slab_page_t *spare; // Empty pages, not yet given a class
+	int nspare;			// Number of spare pages
+	size_t pages;		// Number of pages allocated
+	pthread_mutex_t lock;
+} slab_t;
+
+/* Slab functions */
+void slab_init(slab_t *slab, size_t budget);
+void slab_deinit(slab_t *slab);
+void* slab_alloc(slab_t *slab, size_t size);
+void slab_free(slab_t *slab, void *ptr, size_t size);
+
+#endif /* __SLAB_H__ */
@@ -0,0 +1,273 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * snapshot.c
+ * CODE DESCRIPTION
+ *
+ * Cache snapshots, so a restarted proxy does not start cold. A snapshot
+ * holds every cached line (key, web object, expiry time and hit count),
+ * each shard's lines written from least to most recently queued.
+ * Restoring them in file order rebuilds roughly the same recency order.
+ * Lines gone stale by then are skipped.
+ *
+ * snapshot_save pins a shard's lines under its read lock and writes them
+ * out after letting go of it, so lookups and fills carry on meanwhile.
+ * It writes to path.tmp and renames it over path once it is complete
+ * and synced, so a crash mid-save leaves the previous snapshot intact.
+ *
+ * snapshot_load maps the file and hands it to a background thread, so
+ * the proxy accepts traffic right away. Lines become visible as they are
+ * restored, and pages are read in as the thread reaches them. A line
+ * filled by live traffic in the meantime is fresher and is kept.
+ */
+
+#include "csapp.h"
+#include "snapshot.h"
+
+/* Size of a record with a key of klen bytes and a size-byte object */
+#define SNAP_RECORD_SIZE(klen, size) \
+	((sizeof(snap_record_t) + (klen) + 1 + (size) + 7) & ~(size_t)7)
+
+/* Snapshot being restored */
+typedef struct Restore {
+	cache_t *cache;
+	char *map;			// Mapping of the snapshot file
+	size_t size;		// Size of the file
+} restore_t;
+
+static pthread_t loader;	// Thread restoring the snapshot
+static int loading;			// Whether loader has yet to be joined
+
+static size_t pin_lines(shard_t *shard, line_t ***lines);
+static int write_line(FILE *fp, line_t *line);
+static void *restore(void *vargp);
+
+
+/**************************/
+/*** SNAPSHOT FUNCTIONS ***/
+/**************************/
+
+/*
+ * snapshot_save - write every cached line to the snapshot file path.
+ *		Returns 0 on success, -1 (with a message) on error.
+ */
+int snapshot_save(cache_t *cache, char *path)
+{
+	int s;
+	size_t i, n;
+	FILE *fp;
+	line_t **lines;
+	char tmp[MAXLINE];
+	snap_header_t hdr = { SNAP_MAGIC, SNAP_VERSION, 0 };
+
+	snprintf(tmp, MAXLINE, "%s.tmp", path);
+	if (!(fp = fopen(tmp, "w"))) {
+		fprintf(stderr, "snapshot: %s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+
+	/* Header first, with its count filled in at the end */
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	for (s = 0; s < cache->nshards; s++)
+	{
+		n = pin_lines(&cache->shards[s], &lines);
+		for (i = 0; i < n; i++)
+		{
+			if (!ferror(fp) && !write_line(fp, lines[i]))
+				hdr.count++;
+			release_line(lines[i]);
+		}
+		Free(lines);
+	}
+	rewind(fp);
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+
+	/* Only replace the old snapshot with a complete one */
+	if (fflush(fp) || ferror(fp) || fsync(fileno(fp)) < 0) {
+		fprintf(stderr, "snapshot: %s: %s\n", tmp, strerror(errno));
+		fclose(fp);
+		unlink(tmp);
+		return -1;
+	}
+	fclose(fp);
+	if (rename(tmp, path) < 0) {
+		fprintf(stderr, "snapshot: %s: %s\n", path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * snapshot_load - start restoring the snapshot file path into the cache
+ *		in the background. A missing file is not an error: there is
+ *		nothing to restore on a first start.
+ *		Returns 0 on success, -1 (with a message) on error.
+ */
+int snapshot_load(cache_t *cache, char *path)
+{
+	int fd;
+	struct stat st;
+	restore_t *r;
+	char *map;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		if (errno == ENOENT)
+			return 0;
+		fprintf(stderr, "snapshot: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(snap_header_t) ||
+		(map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+		== MAP_FAILED)
+	{
+		fprintf(stderr, "snapshot: %s: unreadable\n", path);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	/* The file is read front to back, once */
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	r = (restore_t *)Malloc(sizeof(restore_t));
+	r->cache = cache;
+	r->map = map;
+	r->size = st.st_size;
+	Pthread_create(&loader, NULL, restore, r);
+	loading = 1;
+
+	return 0;
+}
+
+/*
+ * snapshot_wait - wait for the snapshot being restored, if any, to be
+ *		fully loaded
+ */
+void snapshot_wait(void)
+{
+	if (loading) {
+		Pthread_join(loader, NULL);
+		loading = 0;
+	}
+}
+
+/******************************/
+/*** END SNAPSHOT FUNCTIONS ***/
+/******************************/
+
+
+/************************/
+/*** HELPER FUNCTIONS ***/
+/************************/
+
+/*
+ * pin_lines - pin every line of a shard, least recently queued first,
+ *		into a new array (*lines) for the caller to release and free.
+ *		Returns the number of lines
+ */
+static size_t pin_lines(shard_t *shard, line_t ***lines)
+{
+	int q;
+	size_t i, n = 0;
+	line_t *line;
+
+	pthread_rwlock_rdlock(&shard->lock);
+	*lines = (line_t **)Malloc((shard->nlines + 1) * sizeof(line_t *));
+
+	/* Queued lines (LRU, S3-FIFO, ARC): main queue first, oldest first */
+	for (q = 1; q >= 0; q--)
+	{
+		for (line = shard->queues[q].tl; line; line = line->prev)
+			(*lines)[n++] = line;
+	}
+	/* Heap lines (GDSF) have no order worth keeping */
+	for (i = 0; i < shard->heap_len; i++)
+		(*lines)[n++] = shard->heap[i];
+
+	for (i = 0; i < n; i++)
+		__atomic_add_fetch(&(*lines)[i]->refcnt, 1, __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&shard->lock);
+
+	return n;
+}
+
+/*
+ * write_line - append a line's record to a snapshot file
+ *		Returns 0 on success, -1 on error
+ */
+static int write_line(FILE *fp, line_t *line)
+{
+	static const char pad[8];
+	snap_record_t rec;
+	obj_seg_t *seg;
+	size_t len = SNAP_RECORD_SIZE(line->klen, line->size);
+
+	rec.klen = line->klen;
+	rec.freq = __atomic_load_n(&line->freq, __ATOMIC_RELAXED);
+	rec.size = line->size;
+	rec.expires = line->expires;
+
+	if (fwrite(&rec, sizeof(rec), 1, fp) != 1 ||
+		fwrite(line->key, 1, line->klen + 1, fp) != line->klen + 1)
+		return -1;
+	for (seg = line->body.hd; seg; seg = seg->next)
+		if (fwrite(seg->data, 1, seg->len, fp) != seg->len)
+			return -1;
+	if (fwrite(pad, 1, len - sizeof(rec) - line->klen - 1 - line->size, fp)
+		!= len - sizeof(rec) - line->klen - 1 - line->size)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * restore - thread function restoring a mapped snapshot into the cache,
+ *		record by record, stopping at the first malformed one
+ */
+static void *restore(void *vargp)
+{
+	restore_t *r = (restore_t *)vargp;
+	snap_header_t *hdr = (snap_header_t *)r->map;
+	snap_record_t *rec;
+	cache_key_t key;
+	size_t off = sizeof(snap_header_t);
+	uint64_t i;
+
+	if (hdr->magic != SNAP_MAGIC || hdr->version != SNAP_VERSION)
+		fprintf(stderr, "snapshot: not a snapshot file\n");
+	else for (i = 0; i < hdr->count; i++)
+	{
+		rec = (snap_record_t *)(r->map + off);
+		if (off + sizeof(snap_record_t) > r->size ||
+			rec->klen > r->size || rec->size > r->size ||
+			off + SNAP_RECORD_SIZE(rec->klen, rec->size) > r->size ||
+			((char *)(rec + 1))[rec->klen] != '\0')
+		{
+			fprintf(stderr, "snapshot: truncated after %lu records\n",
+					(unsigned long)i);
+			break;
+		}
+
+		cache_key(&key, (char *)(rec + 1));
+		restore_object(r->cache, &key, (char *)(rec + 1) + rec->klen + 1,
+					   rec->size, rec->expires, rec->freq);
+		off += SNAP_RECORD_SIZE(rec->klen, rec->size);
+	}
+
+	munmap(r->map, r->size);
+	Free(r);
+	return NULL;
+}
+
+/****************************/
+/*** END HELPER FUNCTIONS ***/
+/****************************/
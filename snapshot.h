@@ -0,0 +1,49 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * snapshot.h
+ * CODE DESCRIPTION
+ *
+ * Header for snapshot.c
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stdint.h>
+#include "webcache.h"
+
+/* Marks a snapshot file, and its format version */
+#define SNAP_MAGIC 0x70786e73
+#define SNAP_VERSION 2
+
+/* Snapshot file header, followed by count records */
+typedef struct SnapHeader {
+	uint32_t magic;		// SNAP_MAGIC
+	uint32_t version;	// SNAP_VERSION
+	uint64_t count;		// Number of records
+} snap_header_t;
+
+/* Record header, followed by the key (with its NUL) and the object,
+ * padded to 8 bytes
+ */
+typedef struct SnapRecord {
+	uint32_t klen;		// Length of the key
+	uint32_t freq;		// Hits counted by the eviction policy
+	uint64_t size;		// Size of the object
+	int64_t expires;	// When the object goes stale
+} snap_record_t;
+
+/* Snapshot functions */
+int snapshot_save(cache_t *cache, char *path);
+int snapshot_load(cache_t *cache, char *path);
+void snapshot_wait(void);
+
+#endif /* __SNAPSHOT_H__ */
@@ -0,0 +1,173 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * uring.c
+ * CODE DESCRIPTION
+ *
+ * Minimal io_uring support on top of the raw io_uring_setup and
+ * io_uring_enter system calls (no liburing). SQEs are queued with
+ * uring_get_sqe and all of them go to the kernel in one uring_enter
+ * call, which also waits for completions.
+ */
+
+#include <sys/syscall.h>
+#include "csapp.h"
+#include "uring.h"
+
+
+/**********************/
+/*** RING FUNCTIONS ***/
+/**********************/
+
+/*
+ * uring_init - set up a ring with room for entries SQEs and map its
+ *		queues. Returns 0 on success, -1 (errno set) if io_uring is
+ *		not available.
+ */
+int uring_init(uring_t *u, unsigned entries)
+{
+	char *sq, *cq;
+	struct io_uring_params p;
+
+	memset(u, 0, sizeof(uring_t));
+	memset(&p, 0, sizeof(p));
+
+	/* Completions are reaped in batches, so give them extra room */
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = 4 * entries;
+	if ((u->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+		return -1;
+
+	u->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	/* Both rings may live in a single mapping */
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_sz > u->sq_sz)
+			u->sq_sz = u->cq_sz;
+		u->cq_sz = u->sq_sz;
+	}
+
+	u->sq_ptr = mmap(NULL, u->sq_sz, PROT_READ | PROT_WRITE,
+					 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ptr == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ptr = u->sq_ptr;
+	else if ((u->cq_ptr = mmap(NULL, u->cq_sz, PROT_READ | PROT_WRITE,
+							   MAP_SHARED | MAP_POPULATE, u->fd,
+							   IORING_OFF_CQ_RING)) == MAP_FAILED)
+		goto fail;
+	u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		goto fail;
+
+	sq = (char *)u->sq_ptr;
+	u->sq_head = (unsigned *)(sq + p.sq_off.head);
+	u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sq_entries = (unsigned *)(sq + p.sq_off.ring_entries);
+	u->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+	cq = (char *)u->cq_ptr;
+	u->cq_head = (unsigned *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return 0;
+
+fail:
+	uring_deinit(u);
+	return -1;
+}
+
+/*
+ * uring_deinit - unmap the ring's queues and close it
+ */
+void uring_deinit(uring_t *u)
+{
+	if (u->sqes && u->sqes != MAP_FAILED)
+		munmap(u->sqes, u->sqes_sz);
+	if (u->cq_ptr && u->cq_ptr != MAP_FAILED && u->cq_ptr != u->sq_ptr)
+		munmap(u->cq_ptr, u->cq_sz);
+	if (u->sq_ptr && u->sq_ptr != MAP_FAILED)
+		munmap(u->sq_ptr, u->sq_sz);
+	close(u->fd);
+}
+
+/*
+ * uring_get_sqe - return a zeroed SQE queued for the next uring_enter.
+ *		If the SQ ring is full, the queued SQEs are submitted first.
+ */
+struct io_uring_sqe *uring_get_sqe(uring_t *u)
+{
+	unsigned tail, idx;
+	struct io_uring_sqe *sqe;
+
+	tail = *u->sq_tail;
+	while (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >=
+		   *u->sq_entries)
+		uring_enter(u, 0);
+
+	idx = tail & *u->sq_mask;
+	sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	u->sq_array[idx] = idx;
+	/* Publish the entry; the kernel only looks at it on uring_enter */
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	u->to_submit++;
+
+	return sqe;
+}
+
+/*
+ * uring_enter - submit every queued SQE and wait until at least
+ *		min_complete completions are available.
+ *		Returns 0 on success, -1 (errno set) on error.
+ */
+int uring_enter(uring_t *u, unsigned min_complete)
+{
+	int rc;
+
+	rc = syscall(__NR_io_uring_enter, u->fd, u->to_submit, min_complete,
+				 min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if (rc < 0)
+		return (errno == EINTR || errno == EAGAIN || errno == EBUSY) ? 0 : -1;
+
+	u->to_submit -= rc;
+	return 0;
+}
+
+/*
+ * uring_peek_cqe - return the oldest unseen completion, NULL if none
+ */
+struct io_uring_cqe *uring_peek_cqe(uring_t *u)
+{
+	unsigned head = *u->cq_head;
+
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &u->cqes[head & *u->cq_mask];
+}
+
+/*
+ * uring_cqe_seen - hand the completion returned by uring_peek_cqe
+ *		back to the kernel
+ */
+void uring_cqe_seen(uring_t *u)
+{
+	__atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**************************/
+/*** END RING FUNCTIONS ***/
+/**************************/
@@ -0,0 +1,48 @@
+/*
+ * 					  CMUQ
+ * 			     15-213, Fall '20
+ * 				    Proxy Lab
+ *
+ *			Written by Nadim Bou Alwan
+ * 			   Andrew ID: nboualwa
+ *
+ *
+ *
+ * uring.h
+ * CODE DESCRIPTION
+ *
+ * Header for uring.c
+ */
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <linux/io_uring.h>
+
+/* io_uring instance, with its shared rings mapped in */
+typedef struct Uring {
+	int fd;						// Ring fd
+	unsigned *sq_head;			// Submission queue (SQ) ring
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_entries;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;	// SQ entries, indexed by sq_array
+	unsigned *cq_head;			// Completion queue (CQ) ring
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned to_submit;			// SQEs queued since the last enter
+	void *sq_ptr, *cq_ptr;		// Mappings, for clean-up
+	size_t sq_sz, cq_sz, sqes_sz;
+} uring_t;
+
+/* Ring functions */
+int uring_init(uring_t *u, unsigned entries);
+void uring_deinit(uring_t *u);
+struct io_uring_sqe *uring_get_sqe(uring_t *u);
+int uring_enter(uring_t *u, unsigned min_complete);
+struct io_uring_cqe *uring_peek_cqe(uring_t *u);
+void uring_cqe_seen(uring_t *u);
+
+#endif /* __URING_H__ */
@@ -13,15 +13,71 @@
  *
  * A fully-associative web cache used by the proxy. Caches client requests
  * and returns them if requested again, instead of having to go through
- * the client's requested server. Uses LRU eviction policy.
+ * the client's requested server. The eviction policy (LRU, S3-FIFO, ARC
+ * or GDSF, see policy.c) is picked at start-up; lines are kept on
+ * doubly-linked queues or a heap as the policy needs.
+ *
+ * The cache is split into shards, picked by key hash, each with its own
+ * index, recency list, lock and share of the byte budget, so threads
+ * working on different keys rarely meet on the same lock.
+ *
+ * Each shard is guarded by a readers-writer lock. Lookups only take the
+ * read lock, so concurrent hits run in parallel; a hit therefore does not
+ * reorder anything itself but just bumps the line's frequency counter.
+ * Eviction, under the write lock, lets the policy act on the counters
+ * before picking its victim, so hits stay O(1).
+ *
+ * With admission on (TinyLFU), every lookup is counted in a per-shard
+ * count-min sketch (sketch.c), and a new key only gets into a full shard
+ * if it has been asked for more often than the line it would evict, so
+ * one-hit wonders do not push out hot lines.
+ *
+ * With a disk tier (disk.c), evicted lines are demoted to disk instead
+ * of being dropped, and objects too large for memory go there directly.
+ * Evictions happen under the write lock, so evicted lines are pinned and
+ * set aside, then written out once the lock is released. A disk hit is
+ * promoted back to memory.
+ *
+ * Every line carries the time it goes stale, worked out from the
+ * response's freshness headers (http.c). A stale line is a miss, and
+ * each shard keeps its lines in a min-heap by expiry time, so eviction
+ * drops stale lines before asking the policy for a victim.
+ * The fetch that replaces a stale object can first revalidate it:
+ * find_stale pins the stale copy, from memory or disk, and once the
+ * server has confirmed it is unchanged, refresh_stale replaces it with a
+ * fresh copy carrying the head updated from the server's answer.
+ *
+ * Lines are reference counted. The cache holds one reference, and
+ * in_cache hands out another that pins the line until the caller is done
+ * writing it to the client (release_line), with no lock held meanwhile.
+ * Eviction only unlinks a line and drops the cache's reference; the last
+ * release frees it.
+ *
+ * Each line (header, key and web object) is a single block from its
+ * shard's slab allocator (slab.c), so an insert makes one allocator call
+ * on a per-shard lock, and a hit reads one contiguous block. Objects too
+ * large for a block are chains of fixed-size segments (obj.c) from the
+ * same allocator, so no object of any size needs one huge allocation.
+ *
+ * Lines are found through a per-shard hash index (open addressing with
+ * linear probing) keyed on a 64-bit hash of the normalized request,
+ * worked out once per request (cache_key). Each slot keeps a copy of the
+ * hash, so probes past non-matching lines rarely touch their keys.
+ *
+ * Responses that vary on request headers (Vary) are cached as variants,
+ * each under the key of the URL extended with the values of the headers
+ * that select it. The hash of a variant key takes its high half, which
+ * picks the shard, from the URL's key, so an object filled for the URL
+ * can be stored as any of its variants. Each shard remembers, in a small
+ * direct-mapped table, which headers the keys it holds vary on, for
+ * lookups to build the variant key before looking for a line.
  * 
- * Maximum cache size: 1 MiB
- * Maximum cache object size: 100 KiB 
+ * Cache and object size limits are set at start-up (cache_conf_t);
+ * sizes are size_t throughout, so multi-GiB caches work on 64-bit hosts.
+ * Default cache size: 1 MiB (split equally between shards)
+ * Default cache object size: 100 KiB 
  *
  *
- * Possible bugs:
- * - Line "count" variable is subject to over/underflow.
- * - Race conditions in reading/writing of cache
  */
 
 #include "csapp.h"
@@ -33,55 +89,342 @@
 /***********************/
 
 /*
- * cache_init - initialize the web cache
+ * cache_init - initialize the web cache with the given settings, sharing
+ *		the cache budget equally between its shards.
+ *		Returns the cache, or NULL if the disk tier cannot be set up.
  */
-cache_t *cache_init() 
+cache_t *cache_init(cache_conf_t *conf) 
 {
-	// Need to do some locking/unlocking magic here
-	
+	int i;
 	cache_t *cache = (cache_t *)Malloc(sizeof(cache_t));
-	cache->size = 0;
-	cache->hd = NULL;
+
+	cache->nshards = conf->nshards;
+	cache->max_size = conf->max_size;
+	cache->max_object_size = conf->max_object_size;
+	cache->policy = conf->policy;
+	cache->admit = conf->admit;
+	cache->disk = NULL;
+	if (conf->disk_dir && !(cache->disk = disk_init(conf->disk_dir,
+													conf->disk_size))) {
+		Free(cache);
+		return NULL;
+	}
+	cache->max_fill_size = cache->max_object_size;
+	if (cache->disk && cache->disk->max_object_size > cache->max_fill_size)
+		cache->max_fill_size = cache->disk->max_object_size;
+	cache->shards = (shard_t *)Calloc(cache->nshards, sizeof(shard_t));
+	for (i = 0; i < cache->nshards; i++)
+	{
+		shard_init(&cache->shards[i], cache->max_size / cache->nshards,
+				   cache->policy);
+		if (cache->admit)
+			sketch_init(&cache->shards[i].sketch, cache->shards[i].max_size);
+		cache->shards[i].disk = cache->disk;
+	}
 
 	return cache;
 }
 
 /*
- * add_object - inserts a web object into the cache
+ * add_object - inserts a web object (obj, as filled from the server)
+ *		into the cache, fresh until expires. Objects small enough to
+ *		share their line's block are copied there; the segments of
+ *		larger ones are handed over to the line as they are, leaving
+ *		obj empty.
  */
-void add_object(cache_t *cache, char *key, char *web_obj, size_t s)
+void add_object(cache_t *cache, cache_key_t *key, obj_t *obj, time_t expires)
 {
-	/* Add the object to the cache if its size is <=MAX_OBJECT_SIZE */
-	if (s <= MAX_OBJECT_SIZE)
+	line_t *line;
+	obj_seg_t *seg;
+	shard_t *shard = cache_shard(cache, key->hash);
+
+	/* Objects too large for memory go straight to the disk tier */
+	if ((obj->len > cache->max_object_size || obj->len > shard->max_size) &&
+		cache->disk)
+		disk_put(cache->disk, key->str, key->len, key->hash, obj, expires);
+
+	/* Add the object to the cache if its size is <=max_object_size,
+	 * and it fits in its shard
+	 */
+	else if (obj->len <= cache->max_object_size && obj->len <= shard->max_size)
 	{	
-		line_t *line = create_line(cache, key, web_obj, s);
-		insert_line(cache, line);
+		/* Copy or move the object in before taking the lock */
+		line = create_line(shard, key, obj->len);
+		if (line->body.hd)
+			for (seg = obj->hd; seg; seg = seg->next)
+				obj_append(&line->body, &shard->slab, seg->data, seg->len,
+						   SIZE_MAX);
+		else {
+			obj_trim(obj, &shard->slab);
+			line->body = *obj;
+			memset(obj, 0, sizeof(obj_t));
+		}
+		line->expires = expires;
+		publish_line(cache, key, line);
+	}
+}
+
+/*
+ * promote_object - add a web object held in one piece (s bytes at
+ *		web_obj, from the disk tier) back to memory, fresh until expires
+ */
+void promote_object(cache_t *cache, cache_key_t *key, char *web_obj, size_t s,
+					time_t expires)
+{
+	line_t *line;
+	shard_t *shard = cache_shard(cache, key->hash);
+
+	if (s > cache->max_object_size || s > shard->max_size)
+		return;
+
+	line = create_line(shard, key, s);
+	obj_append(&line->body, &shard->slab, web_obj, s, SIZE_MAX);
+	line->expires = expires;
+	publish_line(cache, key, line);
+}
+
+/*
+ * restore_object - add an object from a snapshot (snapshot.c), along with
+ *		its hit count. Unlike add_object, a line already cached for the
+ *		key is fresher and is kept, and the admission filter is skipped,
+ *		as the object was admitted before the snapshot. A restored
+ *		variant also tells lookups which headers select it, unless live
+ *		fetches told already.
+ */
+void restore_object(cache_t *cache, cache_key_t *key, char *web_obj, size_t s,
+					time_t expires, unsigned freq)
+{
+	unsigned i;
+	line_t *line, *demoted;
+	char names[MAX_VARY], known[MAX_VARY];
+	shard_t *shard = cache_shard(cache, key->hash);
+
+	if (s > cache->max_object_size || s > shard->max_size ||
+		expires <= time(NULL))
+		return;
+
+	line = create_line(shard, key, s);
+	obj_append(&line->body, &shard->slab, web_obj, s, SIZE_MAX);
+	line->expires = expires;
+	line->freq = (freq < shard->policy->max_freq) ?
+				 freq : shard->policy->max_freq;
+	/* Let the admission filter know the key is popular too */
+	for (i = 0; cache->admit && i < line->freq && i < SKETCH_MAX; i++)
+		sketch_add(&shard->sketch, key->hash);
+
+	pthread_rwlock_wrlock(&shard->lock);
+	if (index_find(shard, key)) {
+		pthread_rwlock_unlock(&shard->lock);
+		release_line(line);
+		return;
 	}
+	insert_line(shard, line);
+	demoted = shard->demoted;
+	shard->demoted = NULL;
+	pthread_rwlock_unlock(&shard->lock);
+
+	demote_lines(shard, demoted);
+
+	if (!variant_names(key->str, names) && cache_vary(cache, key, known) < 0)
+		set_vary(cache, key, names);
 }
 
 /*
- * in_cache - given a request (key), determine whether its respective 
- *		web content is cached.
- *      Returns the object if found, otherwise returns NULL
+ * in_cache - given a normalized request (key), determine whether its respective 
+ *		web content is cached, and still fresh.
+ *      Returns the line, pinned until released with release_line, if
+ *      found, otherwise returns NULL
  */
-line_t* in_cache(cache_t *cache, char *key)
+line_t* in_cache(cache_t *cache, cache_key_t *key)
 {
 	line_t *ptr;
+	unsigned freq;
+	time_t now = time(NULL);
+	shard_t *shard = cache_shard(cache, key->hash);
+
+	/* Count the lookup, hit or miss, for the admission filter */
+	if (cache->admit)
+		sketch_add(&shard->sketch, key->hash);
+
+	pthread_rwlock_rdlock(&shard->lock);
+	/* A stale line is a miss; its refetch will replace it */
+	if ((ptr = index_find(shard, key)) && ptr->expires <= now)
+		ptr = NULL;
+	if (ptr)
+	{	
+		/* Count the hit; saturated first so hits on a hot line do not
+		 * keep writing to it
+		 */
+		freq = __atomic_load_n(&ptr->freq, __ATOMIC_RELAXED);
+		if (freq < shard->policy->max_freq)
+			__atomic_store_n(&ptr->freq, freq + 1, __ATOMIC_RELAXED);
+		/* Pin the line while it cannot be evicted */
+		__atomic_add_fetch(&ptr->refcnt, 1, __ATOMIC_RELAXED);
+	}
+	pthread_rwlock_unlock(&shard->lock);
 
-	/* Accessing cache, so decrement all counts */
-	decr_counts(cache);
+	return ptr;
+}
 
-	for (ptr = cache->hd; ptr != NULL; ptr = ptr->next)
-	{
-		if (!(strcmp(ptr->key, key)))
-		{	
-			/* Increment the usage count of the line and return it */
-			ptr->count++;
-			return ptr;
+/*
+ * in_disk - look a key missing from memory up in the disk tier.
+ *		On a (fresh) hit, fills in hit with the object, pinned until released
+ *		with disk_release, and promotes it back to memory.
+ *		Returns 0 on a hit, -1 otherwise
+ */
+int in_disk(cache_t *cache, cache_key_t *key, disk_hit_t *hit)
+{
+	if (!cache->disk ||
+		disk_get(cache->disk, key->str, key->len, key->hash, hit) < 0)
+		return -1;
+	if (hit->expires <= time(NULL)) {
+		disk_release(hit);
+		return -1;
+	}
+
+	promote_object(cache, key, hit->data, hit->size, hit->expires);
+	return 0;
+}
+
+/*
+ * find_stale - look up a stale copy of a key's object, in memory or in
+ *		the disk tier, to be revalidated with the server. On success,
+ *		fills in stale with it, pinned until released with release_stale.
+ *		Returns 0 if found, -1 otherwise
+ */
+int find_stale(cache_t *cache, cache_key_t *key, stale_t *stale)
+{
+	line_t *line;
+	time_t now = time(NULL);
+	shard_t *shard = cache_shard(cache, key->hash);
+
+	memset(stale, 0, sizeof(stale_t));
+
+	pthread_rwlock_rdlock(&shard->lock);
+	if ((line = index_find(shard, key)) && line->expires <= now &&
+		line->body.hd) {
+		__atomic_add_fetch(&line->refcnt, 1, __ATOMIC_RELAXED);
+		stale->line = line;
+		stale->head = line->body.hd->data;
+		stale->head_len = line->body.hd->len;
+		stale->size = line->size;
+		stale->expires = line->expires;
+	}
+	pthread_rwlock_unlock(&shard->lock);
+	if (line)
+		return stale->line ? 0 : -1;
+
+	if (!cache->disk ||
+		disk_get(cache->disk, key->str, key->len, key->hash, &stale->hit) < 0)
+		return -1;
+	if (stale->hit.expires > now) {
+		disk_release(&stale->hit);
+		return -1;
+	}
+	stale->head = stale->hit.data;
+	stale->head_len = stale->hit.size;
+	stale->size = stale->hit.size;
+	stale->expires = stale->hit.expires;
+	return 0;
+}
+
+/*
+ * refresh_stale - replace a stale copy that the server confirmed
+ *		unchanged with one fresh until expires, its old head (old_len
+ *		bytes) replaced with the updated one (head, len bytes). The new
+ *		copy goes to memory, or to the disk tier if too large, and the
+ *		caller's pin moves to it, for the reply to carry the new head
+ *		too. Failing room anywhere, only the expiry of the
+ *		stale copy is pushed back.
+ */
+void refresh_stale(cache_t *cache, cache_key_t *key, stale_t *stale,
+				   char *head, size_t len, size_t old_len, time_t expires)
+{
+	shard_t *shard = cache_shard(cache, key->hash);
+	size_t size = len + stale->size - old_len;
+	obj_t obj = { NULL, NULL, 0 };
+	disk_hit_t hit;
+	line_t *line;
+
+	if (size <= cache->max_object_size && size <= shard->max_size) {
+		line = create_line(shard, key, size);
+		copy_stale(&line->body, &shard->slab, stale, head, len, old_len);
+		line->expires = expires;
+		/* Pin it for the caller before the cache may drop it */
+		__atomic_add_fetch(&line->refcnt, 1, __ATOMIC_RELAXED);
+		publish_line(cache, key, line);
+		release_stale(stale);
+		stale->line = line;
+		stale->head = line->body.hd->data;
+		stale->head_len = line->body.hd->len;
+		stale->size = size;
+		stale->expires = expires;
+	}
+	else if (cache->disk && size <= cache->disk->max_object_size) {
+		copy_stale(&obj, &shard->slab, stale, head, len, old_len);
+		disk_put(cache->disk, key->str, key->len, key->hash, &obj, expires);
+		obj_free(&obj, &shard->slab);
+		if (!disk_get(cache->disk, key->str, key->len, key->hash, &hit)) {
+			release_stale(stale);
+			stale->hit = hit;
+			stale->head = hit.data;
+			stale->head_len = stale->size = hit.size;
+			stale->expires = hit.expires;
+		}
+	}
+	else if (stale->line) {
+		pthread_rwlock_wrlock(&shard->lock);
+		/* Unless it was evicted or replaced meanwhile */
+		if (index_find(shard, key) == stale->line) {
+			stale->line->expires = expires;
+			expiry_down(shard, stale->line->exp_idx);
 		}
+		pthread_rwlock_unlock(&shard->lock);
 	}
+	else
+		disk_refresh(&stale->hit, key->len, expires);
+}
 
-	return NULL;
+/*
+ * copy_stale - fill obj with head (len bytes) followed by the body of a
+ *		stale copy, past its old head (old_len bytes)
+ */
+void copy_stale(obj_t *obj, slab_t *slab, stale_t *stale, char *head,
+				size_t len, size_t old_len)
+{
+	obj_seg_t *seg;
+	size_t off = old_len;
+
+	obj_append(obj, slab, head, len, SIZE_MAX);
+	if (!stale->line)
+		obj_append(obj, slab, stale->hit.data + off, stale->size - off,
+				   SIZE_MAX);
+	else for (seg = stale->line->body.hd; seg; seg = seg->next) {
+		if (off < seg->len)
+			obj_append(obj, slab, seg->data + off, seg->len - off, SIZE_MAX);
+		off -= (off < seg->len) ? off : seg->len;
+	}
+}
+
+/*
+ * release_stale - unpin a stale copy found by find_stale
+ */
+void release_stale(stale_t *stale)
+{
+	if (stale->line)
+		release_line(stale->line);
+	else if (stale->hit.seg)
+		disk_release(&stale->hit);
+	memset(stale, 0, sizeof(stale_t));
+}
+
+/*
+ * cache_shard - return the shard holding the keys with the given hash.
+ *		Uses the high bits, as the index within the shard uses the low ones.
+ */
+shard_t* cache_shard(cache_t *cache, uint64_t hash)
+{
+	return &cache->shards[(hash >> 32) % cache->nshards];
 }
 
 /*
@@ -89,52 +432,314 @@ line_t* in_cache(cache_t *cache, char *key)
  */
 size_t cache_size(cache_t *cache) 
 {
-	return cache->size;
+	int i;
+	size_t size = 0;
+
+	for (i = 0; i < cache->nshards; i++)
+		size += shard_size(&cache->shards[i]);
+
+	return size;
 }
 
+/***************************/
+/*** END CACHE FUNCTIONS ***/
+/***************************/
+
+
+/***********************/
+/*** SHARD FUNCTIONS ***/
+/***********************/
+
 /*
- * cache_full - Returns whether a cache can fit another web object
- * 			Returns 1 if true, 0 otherwise
+ * shard_init - initialize an empty shard with the given byte budget
+ *		and eviction policy
  */
-int cache_full(cache_t *cache)
+void shard_init(shard_t *shard, size_t max_size, const policy_t *policy)
 {
-	size_t space_left = MAX_CACHE_SIZE - cache_size(cache);
+	memset(shard, 0, sizeof(shard_t));
+	shard->size = 0;
+	shard->max_size = max_size;
+	shard->policy = policy;
+	shard->nlines = 0;
+	shard->slots = INDEX_INIT_SLOTS;
+	shard->index = (slot_t *)Calloc(shard->slots, sizeof(slot_t));
+	slab_init(&shard->slab, max_size);
+	if (policy->init)
+		policy->init(shard);
+	pthread_rwlock_init(&shard->lock, NULL);
+	pthread_mutex_init(&shard->flight_lock, NULL);
+}
 
-	return (space_left <= MAX_OBJECT_SIZE);
+/*
+ * shard_size - return the shard's current size
+ */
+size_t shard_size(shard_t *shard) 
+{
+	return shard->size;
 }
 
 /*
- * cache_empty - Returns whether a cache is empty
+ * shard_empty - Returns whether a shard is empty
  * 			Returns 1 if true, 0 otherwise
  */
-int cache_empty(cache_t *cache)
+int shard_empty(shard_t *shard)
 {	
-	/* Cache is empty if its linked list is empty */
-	return !(!(cache->hd)); // OR !(cache->size)
+	/* Shard is empty if its index is empty */
+	return !(shard->nlines); // OR !(shard->size)
+}
+
+/***************************/
+/*** END SHARD FUNCTIONS ***/
+/***************************/
+
+
+/***********************/
+/*** INDEX FUNCTIONS ***/
+/***********************/
+
+/*
+ * cache_key - fill in a key for the given key string. A variant key
+ *		hashes to the shard of the key it extends.
+ */
+void cache_key(cache_key_t *key, char *str)
+{
+	size_t base;
+
+	key->str = str;
+	key->len = strlen(str);
+	key->hash = hash_key(str, key->len);
+	if ((base = key_base_len(str, key->len)) < key->len)
+		key->hash = (hash_key(str, base) & 0xffffffff00000000ULL) |
+					(key->hash & 0xffffffffULL);
+}
+
+/*
+ * key_base_len - Returns the length of a key string (len bytes, then a
+ *		NUL) without its variant part, if any
+ */
+size_t key_base_len(char *str, size_t len)
+{
+	char *sep = strstr(str, VARIANT_SEP);
+
+	return sep ? (size_t)(sep - str) : len;
+}
+
+/*
+ * hash_key - 64-bit hash of a key of len bytes, mixing in 8 bytes at a time
+ */
+uint64_t hash_key(char *key, size_t len)
+{
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+	uint64_t w;
+
+	for (; len >= 8; key += 8, len -= 8)
+	{
+		memcpy(&w, key, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	w = 0;
+	memcpy(&w, key, len);
+	h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+
+	/* Final avalanche, so the low bits used as slot numbers are mixed */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+/*
+ * index_find - find the line cached for key.
+ *		Returns the line if found, otherwise NULL
+ */
+line_t* index_find(shard_t *shard, cache_key_t *key)
+{
+	size_t mask = shard->slots - 1;
+	size_t i;
+	line_t *line;
+
+	for (i = key->hash & mask; (line = shard->index[i].line);
+		 i = (i + 1) & mask)
+	{
+		/* Only compare keys when the hashes match */
+		if (shard->index[i].hash == key->hash && line->klen == key->len &&
+			!memcmp(line->key, key->str, key->len))
+			return line;
+	}
+
+	return NULL;
+}
+
+/*
+ * index_insert - add a line to the index, growing it to keep it
+ *		at most half full
+ */
+void index_insert(shard_t *shard, line_t *line)
+{
+	size_t mask, i;
+
+	if (2 * (shard->nlines + 1) > shard->slots)
+		index_grow(shard);
+
+	mask = shard->slots - 1;
+	for (i = line->hash & mask; shard->index[i].line; i = (i + 1) & mask)
+		;
+	shard->index[i].hash = line->hash;
+	shard->index[i].line = line;
+	shard->nlines++;
+}
+
+/*
+ * index_remove - remove a line from the index. Lines after it in the
+ *		same probe run are shifted back, so no tombstones are needed.
+ */
+void index_remove(shard_t *shard, line_t *line)
+{
+	size_t mask = shard->slots - 1;
+	size_t i, j, home;
+
+	/* Find the line's own slot */
+	for (i = line->hash & mask; shard->index[i].line != line; i = (i + 1) & mask)
+		if (!shard->index[i].line)
+			return;
+
+	/* Move back every later entry whose home slot is not in (i, j] */
+	for (j = (i + 1) & mask; shard->index[j].line; j = (j + 1) & mask)
+	{
+		home = shard->index[j].hash & mask;
+		if ((j > i && (home <= i || home > j)) ||
+			(j < i && (home <= i && home > j)))
+		{
+			shard->index[i] = shard->index[j];
+			i = j;
+		}
+	}
+
+	shard->index[i].line = NULL;
+	shard->nlines--;
 }
 
 /*
- * decr_counts - Decrements the usage count of each line.
- * 			Following the LRU policy, this is called every time
- *			the cache is accessed to be able to determine the LRU line.
- *			The line with the lowest usage count gets evicted.
+ * index_grow - double the number of index slots and re-insert every line
  */
-void decr_counts(cache_t *cache)
+void index_grow(shard_t *shard)
 {
-	line_t *line = cache->hd;
+	slot_t *old = shard->index;
+	size_t old_slots = shard->slots;
+	size_t mask, i, j;
+
+	shard->slots *= 2;
+	shard->index = (slot_t *)Calloc(shard->slots, sizeof(slot_t));
+	mask = shard->slots - 1;
 
-	while (line)
+	for (i = 0; i < old_slots; i++)
 	{
-		line->count--;
-		line = line->next;
+		if (!old[i].line)
+			continue;
+		for (j = old[i].hash & mask; shard->index[j].line; j = (j + 1) & mask)
+			;
+		shard->index[j] = old[i];
 	}
+
+	Free(old);
 }
 
 /***************************/
-/*** END CACHE FUNCTIONS ***/
+/*** END INDEX FUNCTIONS ***/
 /***************************/
 
 
+/*************************/
+/*** VARIANT FUNCTIONS ***/
+/*************************/
+
+/*
+ * cache_vary - look up the request headers the responses for key (the
+ *		key of a URL, or of any of its variants) vary on, into names
+ *		(MAX_VARY).
+ *		Returns 0 if they are known to vary, -1 otherwise.
+ */
+int cache_vary(cache_t *cache, cache_key_t *key, char *names)
+{
+	int rv = -1;
+	vary_t *v;
+	uint64_t hash = hash_key(key->str, key_base_len(key->str, key->len));
+	shard_t *shard = cache_shard(cache, key->hash);
+
+	pthread_rwlock_rdlock(&shard->lock);
+	if (shard->varies) {
+		v = &shard->varies[hash & (VARY_SLOTS - 1)];
+		if (v->hash == hash) {
+			strcpy(names, v->names);
+			rv = 0;
+		}
+	}
+	pthread_rwlock_unlock(&shard->lock);
+
+	return rv;
+}
+
+/*
+ * set_vary - record the request headers (names, see http_resp_t) the
+ *		responses for key (the key of a URL, or of any of its variants)
+ *		vary on; "" if they do not vary. A key that collides with
+ *		another in the table takes its slot.
+ */
+void set_vary(cache_t *cache, cache_key_t *key, char *names)
+{
+	vary_t *v;
+	uint64_t hash = hash_key(key->str, key_base_len(key->str, key->len));
+	shard_t *shard = cache_shard(cache, key->hash);
+
+	/* Nothing to forget in a shard where nothing varies yet; the table
+	 * pointer is only ever set once, under the lock, so an atomic peek
+	 * at it is enough to skip taking the lock
+	 */
+	if (!*names && !__atomic_load_n(&shard->varies, __ATOMIC_RELAXED))
+		return;
+
+	pthread_rwlock_wrlock(&shard->lock);
+	if (!shard->varies)
+		__atomic_store_n(&shard->varies,
+						 (vary_t *)Calloc(VARY_SLOTS, sizeof(vary_t)),
+						 __ATOMIC_RELAXED);
+	v = &shard->varies[hash & (VARY_SLOTS - 1)];
+	if (*names) {
+		v->hash = hash;
+		strcpy(v->names, names);
+	}
+	else if (v->hash == hash)
+		v->hash = 0;
+	pthread_rwlock_unlock(&shard->lock);
+}
+
+/*
+ * variant_names - copy the request headers a variant key string is
+ *		selected by into names (MAX_VARY).
+ *		Returns 0 on success, -1 if str is not a variant key.
+ */
+int variant_names(char *str, char *names)
+{
+	char *p = strstr(str, VARIANT_SEP);
+	size_t n;
+
+	if (!p)
+		return -1;
+	p += sizeof(VARIANT_SEP) - 1;
+	if ((n = strcspn(p, "\n")) >= MAX_VARY)
+		return -1;
+	memcpy(names, p, n);
+	names[n] = '\0';
+	return 0;
+}
+
+/*****************************/
+/*** END VARIANT FUNCTIONS ***/
+/*****************************/
+
+
 /**********************/
 /*** LINE FUNCTIONS ***/
 /**********************/
@@ -148,75 +753,176 @@ size_t line_size(line_t *line)
 }
 
 /*
- * line_count - return the usage count of the line. Used for LRU purposes
+ * line_block_size - return the size of the slab block holding a line
+ *		with a key of klen bytes and s bytes of web content. Objects
+ *		small enough share the block, in a single segment; the segments
+ *		of larger ones are blocks of their own (obj.c).
  */
-int line_count(line_t *line)
+size_t line_block_size(shard_t *shard, size_t klen, size_t s)
 {
-	return line->count;
+	size_t size = sizeof(line_t) + klen + 1;
+
+	if (size + sizeof(obj_seg_t) + s <= shard->slab.max_block)
+		size += sizeof(obj_seg_t) + s;
+	return size;
 }
 
 /*
- * create_line - create a line to be inserted into the cache
+ * create_line - create a line to be inserted into the cache, with room
+ *		for s bytes of web content, to be filled with obj_append. The
+ *		key, and a small enough web object, are stored right after the
+ *		line itself.
  */
-line_t* create_line(cache_t *cache, char *key, char *web_obj, size_t s)
+line_t* create_line(shard_t *shard, cache_key_t *key, size_t s)
 {
-	line_t *new_line = (line_t *)(Malloc(sizeof(line_t)));
+	size_t block = line_block_size(shard, key->len, s);
+	line_t *new_line = (line_t *)slab_alloc(&shard->slab, block);
 
 	/* Initialize line values */
 	new_line->size = s;
+	new_line->hash = key->hash;
+	new_line->klen = key->len;
+	new_line->shard = shard;
+	new_line->refcnt = 1; // The cache's reference
+	new_line->queue = NULL;
+	new_line->prev = NULL;
 	new_line->next = NULL;
-	new_line->count = 1; // Considering current use
-	new_line->key = (char *)(Malloc(strlen(key)+1));
-	new_line->web_obj = (char *)(Malloc(s));
+	new_line->freq = 0;
+	memset(&new_line->body, 0, sizeof(obj_t));
+
+	/* One segment of exactly s bytes if the object shares the block */
+	if (block > sizeof(line_t) + key->len + 1) {
+		new_line->body.hd = new_line->body.tl = (obj_seg_t *)(new_line + 1);
+		new_line->body.hd->next = NULL;
+		new_line->body.hd->len = 0;
+		new_line->body.hd->cap = s;
+		new_line->key = new_line->body.hd->data + s;
+	}
+	else
+		new_line->key = (char *)(new_line + 1);
 
 	/* Save line values */
-	strcpy(new_line->key, key);
-	memcpy(new_line->web_obj, web_obj, s);
+	memcpy(new_line->key, key->str, key->len + 1);
 
 	return new_line;
 }
 
 /*
- * insert_line - insert a just-created line into the cache
+ * publish_line - make a new, filled line the cached copy of its key.
+ *		A fresher copy replaces any line already cached for the key;
+ *		otherwise, the admission filter may turn the new key away.
  */
-void insert_line(cache_t *cache, line_t *line)
+void publish_line(cache_t *cache, cache_key_t *key, line_t *line)
+{
+	line_t *old, *demoted;
+	shard_t *shard = line->shard;
+
+	pthread_rwlock_wrlock(&shard->lock);
+	if ((old = index_find(shard, key)))
+		remove_line(shard, old);
+	else if (cache->admit && !admit_line(shard, line)) {
+		pthread_rwlock_unlock(&shard->lock);
+		release_line(line);
+		return;
+	}
+	insert_line(shard, line);
+	demoted = shard->demoted;
+	shard->demoted = NULL;
+	pthread_rwlock_unlock(&shard->lock);
+
+	/* Write what was evicted to disk, now that the lock is free */
+	demote_lines(shard, demoted);
+}
+
+/*
+ * insert_line - insert a just-created line into its shard
+ */
+void insert_line(shard_t *shard, line_t *line)
 {	
-	/* Check if the cache is full; evict if necessary */
-	if(cache_full(cache))
-		evict(cache);
+	/* Evict lines until the new one fits */
+	while (!shard_empty(shard) && 
+		   shard_size(shard) + line_size(line) > shard->max_size)
+		evict(shard);
+
+	/* Hand the line to the eviction policy */
+	shard->policy->insert(shard, line);
+	expiry_push(shard, line);
+	/* Make the line findable */
+	index_insert(shard, line);
+	/* Increase the shard size */
+	shard->size += line_size(line);
+}
 
-	/* Point line's next to the current head of the list if it exists */
-	if (cache->hd)
-		line->next = cache->hd;
-	/* Add line at the head of the list */
-	cache->hd = line;
-	/* Increase the cache size */
-	cache->size += line_size(line);
+/*
+ * remove_line - remove a given line from the recency list and the index
+ */
+void remove_line(shard_t *shard, line_t *line)
+{
+	/* Update the policy and index to reflect loss of line */
+	shard->policy->remove(shard, line);
+	expiry_remove(shard, line);
+	index_remove(shard, line);
+	/* Decrement the shard size and drop the cache's reference */
+	shard->size -= line_size(line);
+	release_line(line);
 }
 
 /*
- * remove_line - remove a given line from the linked list
+ * release_line - drop a reference to a line, freeing it with the last one
  */
-void remove_line(cache_t *cache, line_t *line)
+void release_line(line_t *line)
 {
-	line_t *ptr = cache->hd;
+	if (!__atomic_sub_fetch(&line->refcnt, 1, __ATOMIC_ACQ_REL))
+		free_line(line->shard, line);
+}
 
-	/* Update the linked list to make the pointers reflect loss of line */
-	while (ptr)
-	{
-		/* Line found: free it and make current next point to line next */
-		if (ptr->next == line)
-		{
-			/* Update linked list */
-			ptr->next = line->next;
-			/* Decrement the cache size and free the line */
-			cache->size -= line_size(line);
-			free_line(cache, line);
-			return;
-		}
+/*
+ * touch_line - move a line to the front of its queue
+ */
+void touch_line(line_t *line)
+{
+	queue_t *queue = line->queue;
 
-		ptr = ptr->next;
-	}
+	if (queue->hd == line)
+		return;
+	unlink_line(line);
+	link_line(queue, line);
+}
+
+/*
+ * link_line - add a line at the front of a queue
+ */
+void link_line(queue_t *queue, line_t *line)
+{
+	line->queue = queue;
+	line->prev = NULL;
+	line->next = queue->hd;
+	if (queue->hd)
+		queue->hd->prev = line;
+	else
+		queue->tl = line;
+	queue->hd = line;
+	queue->size += line_size(line);
+}
+
+/*
+ * unlink_line - take a line out of its queue
+ */
+void unlink_line(line_t *line)
+{
+	queue_t *queue = line->queue;
+
+	if (line->prev)
+		line->prev->next = line->next;
+	else
+		queue->hd = line->next;
+	if (line->next)
+		line->next->prev = line->prev;
+	else
+		queue->tl = line->prev;
+	queue->size -= line_size(line);
+	line->prev = line->next = NULL;
+	line->queue = NULL;
 }
 
 /**************************/
@@ -229,45 +935,75 @@ void remove_line(cache_t *cache, line_t *line)
 /**************************/
 
 /*
- * evict - Evict a line from the cache based on LRU policy
+ * evict - Evict a stale line if there is one, otherwise the line picked
+ *		by the shard's eviction policy
  */
-void evict(cache_t *cache)
+void evict(shard_t *shard)
 {
-	line_t *line = lru_line(cache);
-	remove_line(cache, line);
+	line_t *line;
+
+	/* Stale lines are worth keeping neither here nor on disk */
+	if (shard->expiry_len && shard->expiry[0]->expires <= time(NULL)) {
+		remove_line(shard, shard->expiry[0]);
+		return;
+	}
+
+	line = shard->policy->victim(shard);
+
+	if (shard->policy->evicted)
+		shard->policy->evicted(shard, line);
+	if (!shard->disk) {
+		remove_line(shard, line);
+		return;
+	}
+
+	/* Keep the line pinned, and set it aside to be demoted */
+	__atomic_add_fetch(&line->refcnt, 1, __ATOMIC_RELAXED);
+	remove_line(shard, line);
+	line->next = shard->demoted;
+	shard->demoted = line;
 }
 
 /*
- * lru_line - Returns the least recently used line in the cache.
- * 		If more than one line is least used, returns the first such line.
+ * demote_lines - write evicted lines, linked through next, to the disk
+ *		tier (unless it has them already), then unpin them.
+ *		Called without the lock.
  */
-line_t* lru_line(cache_t *cache)
+void demote_lines(shard_t *shard, line_t *lines)
 {
-	int count_next, lru_count;
-	line_t *lru, *ptr;
-
-	/* A current pointer for comparison */
-	ptr = cache->hd; 
-	/* In the beginning, LRU line is assumed to be the first line */
-	lru = ptr;
-	/* lru_line only called when cache is full, so no need for NULL check */
-	lru_count = line_count(lru);
+	line_t *line;
 
-	while (ptr)
+	while ((line = lines))
 	{
-		/* Get the usage count of the next line in the list */
-		count_next = line_count(ptr);
-		/* If the next line has been used less recently, make it the new lru */
-		if (count_next < lru_count)
-		{
-			lru_count = count_next;
-			lru = ptr;
-		}
-
-		ptr = ptr->next;
-	}	
+		lines = line->next;
+		if (!disk_contains(shard->disk, line->key, line->klen, line->hash))
+			disk_put(shard->disk, line->key, line->klen, line->hash,
+					 &line->body, line->expires);
+		release_line(line);
+	}
+}
 
-	return lru;
+/*
+ * admit_line - TinyLFU admission: decide whether a new line may take
+ *		a place in the shard. Lines that fit without evicting are always
+ *		admitted; otherwise the new key must have been looked up more
+ *		often than the policy's next victim.
+ *		Returns 1 if admitted, 0 otherwise
+ */
+int admit_line(shard_t *shard, line_t *line)
+{
+	line_t *victim;
+
+	if (shard_empty(shard) ||
+		shard_size(shard) + line_size(line) <= shard->max_size)
+		return 1;
+	/* Room will be made from stale lines first */
+	if (shard->expiry[0]->expires <= time(NULL))
+		return 1;
+
+	victim = shard->policy->victim(shard);
+	return sketch_estimate(&shard->sketch, line->hash) >
+		   sketch_estimate(&shard->sketch, victim->hash);
 }
 
 /******************************/
@@ -275,65 +1011,153 @@ line_t* lru_line(cache_t *cache)
 /******************************/
 
 
-/**************************/
-/*** CLEAN-UP FUNCTIONS ***/
-/**************************/ 
+/************************/
+/*** EXPIRY FUNCTIONS ***/
+/************************/
 
 /*
- * free_line - Free the given line of its contents
+ * expiry_push - add a line to the shard's expiry heap
  */
-void free_line(cache_t *cache, line_t *line)
-{		
-	/* Only pointers can have freedom */
-	Free(line->web_obj);
-	Free(line->key);
-	Free(line);
+void expiry_push(shard_t *shard, line_t *line)
+{
+	if (shard->expiry_len == shard->expiry_cap) {
+		shard->expiry_cap = shard->expiry_cap ? 2 * shard->expiry_cap : 64;
+		shard->expiry = (line_t **)Realloc(shard->expiry,
+										   shard->expiry_cap * sizeof(line_t *));
+	}
+
+	line->exp_idx = shard->expiry_len;
+	shard->expiry[shard->expiry_len++] = line;
+	expiry_up(shard, line->exp_idx);
 }
 
 /*
- * free_cache - Free the given cache of its contents
+ * expiry_remove - take a line out of the shard's expiry heap
  */
-void free_cache(cache_t *cache)
+void expiry_remove(shard_t *shard, line_t *line)
 {
-	line_t *line = cache->hd;
+	size_t i = line->exp_idx;
 
-	/* Free the line & cache and return if the cache has only one line */
-	if (!(line->next))
-	{
-		free_line(cache, line);
-		Free(cache);
-		return;
+	if (i != --shard->expiry_len) {
+		expiry_swap(shard, i, shard->expiry_len);
+		expiry_down(shard, i);
+		expiry_up(shard, i);
 	}
+}
 
-	/* A next line for iteration */
-	line_t *line_next = line->next;
+/*
+ * expiry_up - move the line at position i up the heap into place
+ */
+void expiry_up(shard_t *shard, size_t i)
+{
+	size_t parent;
 
-	while (line)
+	for (; i > 0; i = parent)
 	{
-		line_next = line->next;
-		free_line(cache, line);
-		line = line_next;
+		parent = (i - 1) / 2;
+		if (shard->expiry[parent]->expires <= shard->expiry[i]->expires)
+			break;
+		expiry_swap(shard, i, parent);
 	}
-
-	Free(cache);
 }
 
-/******************************/
-/*** END CLEAN-UP FUNCTIONS ***/
-/******************************/
-
-
-
-
+/*
+ * expiry_down - move the line at position i down the heap into place
+ */
+void expiry_down(shard_t *shard, size_t i)
+{
+	size_t child;
 
+	while ((child = 2 * i + 1) < shard->expiry_len)
+	{
+		if (child + 1 < shard->expiry_len &&
+			shard->expiry[child + 1]->expires < shard->expiry[child]->expires)
+			child++;
+		if (shard->expiry[i]->expires <= shard->expiry[child]->expires)
+			break;
+		expiry_swap(shard, i, child);
+		i = child;
+	}
+}
 
+/*
+ * expiry_swap - swap two lines of the expiry heap
+ */
+void expiry_swap(shard_t *shard, size_t i, size_t j)
+{
+	line_t *tmp = shard->expiry[i];
 
+	shard->expiry[i] = shard->expiry[j];
+	shard->expiry[j] = tmp;
+	shard->expiry[i]->exp_idx = i;
+	shard->expiry[j]->exp_idx = j;
+}
 
+/****************************/
+/*** END EXPIRY FUNCTIONS ***/
+/****************************/
 
 
+/**************************/
+/*** CLEAN-UP FUNCTIONS ***/
+/**************************/ 
 
+/*
+ * free_line - Free the given line of its contents
+ */
+void free_line(shard_t *shard, line_t *line)
+{		
+	/* Only pointers can have freedom; the key, and a small web object,
+	 * share the line's block
+	 */
+	if (line->body.hd != (obj_seg_t *)(line + 1))
+		obj_free(&line->body, &shard->slab);
+	slab_free(&shard->slab, line,
+			  line_block_size(shard, line->klen, line->size));
+}
 
+/*
+ * free_shard - Free the given shard of its contents
+ */
+void free_shard(shard_t *shard)
+{
+	size_t i;
+
+	/* Every line is in the index, whatever the policy */
+	for (i = 0; i < shard->slots; i++)
+		if (shard->index[i].line)
+			release_line(shard->index[i].line);
+
+	if (shard->policy->deinit)
+		shard->policy->deinit(shard);
+	if (shard->sketch.counters)
+		sketch_deinit(&shard->sketch);
+	pthread_rwlock_destroy(&shard->lock);
+	pthread_mutex_destroy(&shard->flight_lock);
+	slab_deinit(&shard->slab);
+	if (shard->varies)
+		Free(shard->varies);
+	Free(shard->index);
+	if (shard->expiry)
+		Free(shard->expiry);
+}
 
+/*
+ * free_cache - Free the given cache of its contents
+ */
+void free_cache(cache_t *cache)
+{
+	int i;
 
+	for (i = 0; i < cache->nshards; i++)
+		free_shard(&cache->shards[i]);
+	if (cache->disk)
+		disk_deinit(cache->disk);
 
+	Free(cache->shards);
+	Free(cache);
+}
 
+/******************************/
+/*** END CLEAN-UP FUNCTIONS ***/
+/******************************/
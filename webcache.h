@@ -2,9 +2,9 @@
  * 					  CMUQ
  * 			     15-213, Fall '20
  * 				    Proxy Lab
- *				
+ *
  *			Written by Nadim Bou Alwan
- * 			   Andrew ID: nboualwa 
+ * 			   Andrew ID: nboualwa
  *
  *
  *
@@ -14,42 +14,218 @@
  * Header for webcache.c
  */
 
+#ifndef __WEBCACHE_H__
+#define __WEBCACHE_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "slab.h"
+#include "obj.h"
+#include "policy.h"
+#include "sketch.h"
+#include "disk.h"
+#include "http.h"
 
-/* Recommended max cache and object sizes */
+/* Default max cache and object sizes (see cache_conf_t) */
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
 
+/* Default number of cache shards */
+#define DEF_SHARDS 8
+
+/* Initial number of hash index slots (a power of 2) */
+#define INDEX_INIT_SLOTS 64
+
+/* Buckets of each shard's table of fetches in progress (a power of 2) */
+#define FLIGHT_BUCKETS 64
+
+/* Slots of each shard's table of keys whose responses vary on request
+ * headers (a power of 2)
+ */
+#define VARY_SLOTS 256
+
+/* Start of the variant part of a key (see variant_key in proxy.c) */
+#define VARIANT_SEP "\n\nvary: "
+
+struct Shard; // Defined below
+struct Queue;
+struct Flight; // Defined in flight.h
+
+/* Cache key: a normalized request (see build_key in proxy.c), with its
+ * length and hash worked out once. The key of a variant of an object
+ * adds the request headers selecting it after VARIANT_SEP; its hash
+ * keeps the high half of the object's, so all variants share a shard.
+ */
+typedef struct CacheKey {
+	char *str;		// Key string
+	size_t len;		// Its length
+	uint64_t hash;	// hash_key of the string (see cache_key)
+} cache_key_t;
+
 /* Line structure */
 typedef struct Line {
-	size_t size;	// Size of the content (web_obj)
-	int count; 		// Usage count, for LRU 
-	char *key;      // Client request, used for identification
-	char *web_obj;  // Contents of the web object
-	struct Line *next;
+	size_t size;	// Size of the content (body)
+	uint64_t hash;  // Hash of the key
+	int refcnt;     // References: the cache's, plus one per pinned hit
+	struct Shard *shard; // Shard holding the line
+	char *key;      // Normalized request, used for identification
+	size_t klen;    // Length of the key
+	obj_t body;     // Contents of the web object
+	unsigned freq;  // Hits, up to the policy's max_freq (policy.c)
+	struct Queue *queue; // Queue holding the line, if any
+	struct Line *prev; // Next more recently queued line
+	struct Line *next; // Next less recently queued line
+	double prio;	// GDSF priority
+	unsigned prio_freq; // freq when prio was computed
+	size_t heap_idx; // Position in the GDSF heap
+	time_t expires;	// When the object goes stale
+	size_t exp_idx;	// Position in the shard's expiry heap
 } line_t;
 
+/* Stale copy of an object, pinned while it is revalidated: a memory
+ * line or a disk tier object
+ */
+typedef struct Stale {
+	line_t *line;	// Line holding it, if in memory
+	disk_hit_t hit;	// Disk tier object, if on disk
+	char *head;		// Start of the object, NULL if there is none...
+	size_t head_len; // ... and how much of it is contiguous there
+	size_t size;	// Its size
+	time_t expires;	// When it went stale
+} stale_t;
+
+/* Queue of lines (recency list or FIFO), newest at the front */
+typedef struct Queue {
+	struct Line *hd;  // Newest line
+	struct Line *tl;  // Oldest line
+	size_t size;	  // Total size of the lines
+} queue_t;
+
+/* Hash index slot; empty when line is NULL */
+typedef struct Slot {
+	uint64_t hash;  // Copy of line->hash, so probes rarely touch the line
+	line_t *line;
+} slot_t;
+
+/* Vary table slot: the request headers the responses for a key vary
+ * on; empty when hash is 0
+ */
+typedef struct Vary {
+	uint64_t hash;	// Hash of the key (without any variant part)
+	char names[MAX_VARY]; // See http_resp_t
+} vary_t;
+
+/* Shard structure: an independent part of the cache, with its own
+ * index, recency list, lock and byte budget
+ */
+typedef struct Shard {
+	size_t size; 	  // Overall size of the shard
+	size_t max_size;  // Byte budget of the shard
+	const policy_t *policy; // Eviction policy
+	queue_t queues[2]; // Line queues, used as the policy sees fit
+	ghost_t ghosts[2]; // Ghost lists of evicted keys (S3-FIFO, ARC)
+	size_t target;	  // ARC's target size of T1
+	double clock;	  // GDSF's inflation value L
+	struct Line **heap; // GDSF's min-heap of lines
+	size_t heap_len;  // Lines in the heap
+	size_t heap_cap;  // Room in the heap
+	struct Line **expiry; // Min-heap of the lines by expiry time
+	size_t expiry_len; // Lines in the expiry heap
+	size_t expiry_cap; // Room in the expiry heap
+	slot_t *index;    // Open-addressing (linear probing) index of the lines
+	size_t slots;     // Number of index slots, a power of 2
+	size_t nlines;    // Number of lines in the shard
+	pthread_rwlock_t lock; // Read-locked by lookups, write-locked otherwise
+	slab_t slab;	  // Allocator for the shard's lines
+	sketch_t sketch;  // Key frequencies, if admission is on
+	disk_t *disk;	  // Disk tier evicted lines are demoted to, if any
+	struct Line *demoted; // Evicted lines waiting to be written to disk
+	struct Flight *flights[FLIGHT_BUCKETS]; // Fetches in progress, by hash
+	pthread_mutex_t flight_lock; // Guards flights
+	vary_t *varies;	  // Keys known to vary, by hash; NULL until one is
+} shard_t;
+
+/* Web Cache settings, fixed at start-up */
+typedef struct CacheConf {
+	int nshards;	  // Number of shards
+	size_t max_size;  // Byte budget of the whole cache
+	size_t max_object_size; // Largest web object that gets cached
+	const policy_t *policy; // Eviction policy
+	int admit;		  // Whether new lines go through the TinyLFU filter
+	char *disk_dir;	  // Directory of the disk tier, NULL for none
+	size_t disk_size; // Size of the disk tier
+} cache_conf_t;
+
 /* Web Cache structure */
 typedef struct Cache {
-	size_t size; 	  // Overall size of the cache
-	struct Line *hd;  // A pointer to the header line in the cache
+	int nshards;	  // Number of shards
+	size_t max_size;  // Byte budget, split equally between shards
+	size_t max_object_size; // Largest web object that gets cached
+	const policy_t *policy; // Eviction policy
+	int admit;		  // Whether new lines go through the TinyLFU filter
+	disk_t *disk;	  // Disk tier, NULL for none
+	size_t max_fill_size; // Largest web object worth keeping (either tier)
+	shard_t *shards;  // Shards, picked by key hash
 } cache_t;
 
 /* Cache functions */
-cache_t* cache_init();
-int cache_full(cache_t *cache);
-int cache_empty(cache_t *cache);
-void decr_counts(cache_t *cache);
+cache_t* cache_init(cache_conf_t *conf);
 size_t cache_size(cache_t *cache);
-line_t* in_cache(cache_t *cache, char *key);
-void add_object(cache_t *cache, char *key, char *web_obj, size_t s);
+shard_t* cache_shard(cache_t *cache, uint64_t hash);
+line_t* in_cache(cache_t *cache, cache_key_t *key);
+int in_disk(cache_t *cache, cache_key_t *key, disk_hit_t *hit);
+int find_stale(cache_t *cache, cache_key_t *key, stale_t *stale);
+void refresh_stale(cache_t *cache, cache_key_t *key, stale_t *stale,
+				   char *head, size_t len, size_t old_len, time_t expires);
+void copy_stale(obj_t *obj, slab_t *slab, stale_t *stale, char *head,
+				size_t len, size_t old_len);
+void release_stale(stale_t *stale);
+void add_object(cache_t *cache, cache_key_t *key, obj_t *obj, time_t expires);
+void promote_object(cache_t *cache, cache_key_t *key, char *web_obj, size_t s,
+					time_t expires);
+void restore_object(cache_t *cache, cache_key_t *key, char *web_obj, size_t s,
+					time_t expires, unsigned freq);
+/* Shard functions */
+void shard_init(shard_t *shard, size_t max_size, const policy_t *policy);
+int shard_empty(shard_t *shard);
+size_t shard_size(shard_t *shard);
+/* Index functions */
+void cache_key(cache_key_t *key, char *str);
+size_t key_base_len(char *str, size_t len);
+uint64_t hash_key(char *key, size_t len);
+line_t* index_find(shard_t *shard, cache_key_t *key);
+void index_insert(shard_t *shard, line_t *line);
+void index_remove(shard_t *shard, line_t *line);
+void index_grow(shard_t *shard);
+/* Variant functions */
+int cache_vary(cache_t *cache, cache_key_t *key, char *names);
+void set_vary(cache_t *cache, cache_key_t *key, char *names);
+int variant_names(char *str, char *names);
 /* Line functions */
 size_t line_size(line_t *line);
-void insert_line(cache_t *cache, line_t *line);
-void remove_line(cache_t *cache, line_t *line);
-line_t* create_line(cache_t *cache, char *key, char *web_obj, size_t s);
+size_t line_block_size(shard_t *shard, size_t klen, size_t s);
+void insert_line(shard_t *shard, line_t *line);
+void remove_line(shard_t *shard, line_t *line);
+void release_line(line_t *line);
+line_t* create_line(shard_t *shard, cache_key_t *key, size_t s);
+void publish_line(cache_t *cache, cache_key_t *key, line_t *line);
+void touch_line(line_t *line);
+void link_line(queue_t *queue, line_t *line);
+void unlink_line(line_t *line);
 /* Eviction functions */
-void evict(cache_t *cache);
-line_t* lru_line(cache_t *cache);
+void evict(shard_t *shard);
+void demote_lines(shard_t *shard, line_t *lines);
+int admit_line(shard_t *shard, line_t *line);
+/* Expiry functions */
+void expiry_push(shard_t *shard, line_t *line);
+void expiry_remove(shard_t *shard, line_t *line);
+void expiry_up(shard_t *shard, size_t i);
+void expiry_down(shard_t *shard, size_t i);
+void expiry_swap(shard_t *shard, size_t i, size_t j);
 /* Clean-up functions */
 void free_cache(cache_t *cache);
-void free_line(cache_t *cache, line_t *line);
\ No newline at end of file
+void free_shard(shard_t *shard);
+void free_line(shard_t *shard, line_t *line);
+
+#endif /* __WEBCACHE_H__ */